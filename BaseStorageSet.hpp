@@ -8,21 +8,25 @@
 #pragma once
 
 #include "../Core/PebbleCom.hpp"
+#include "Trace.hpp"
 
 
 namespace pebble {
 
 static constexpr size_t minPageSize         = 8;
-static constexpr size_t densePageSizeMax    = maxValue<uint16_t>();
 static constexpr size_t defaultPageSize     = 4096;
 static constexpr size_t defaultPageCountMax = 16;
 
 template <typename Key, size_t keyPrefixBitCount>
 struct BaseKeyInfo;
 
-template <typename Key, size_t keyPrefixBitCount, typename Type>
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage = std::vector<Type>>
 class StorageSet;
 
+template <typename Key, size_t keyPrefixBitCount>
+class KeyRemap;
+
 
 
 template <typename Key, size_t keyPrefixBitCount>
@@ -46,7 +50,8 @@ public:
   const std::type_info& keyType() { return keyType_(); }
   virtual const std::type_info& storageType() = 0;
 
-  virtual void clear() = 0;
+  // drops every key but keeps the allocated sparse pages for reuse
+  virtual void clear();
 
   BaseKey densePosFromKey(size_t page, size_t offset) {
     if (page < pageCount_ && sparse_[page] && offset < sparse_[page]->size())
@@ -60,18 +65,59 @@ public:
     return densePosFromKey(page, offset);
   }
 
-  Key validCount() { return dense_.size() - recyclingCount_; }
-  Key totalCount() { return dense_.size();    }
+  virtual Key validCount() { return dense_.size() - recyclingCount_; }
+  Key totalCount() { return dense_.size(); }
 
   auto keyBegin()  { return dense_.cbegin();  }
   auto keyEnd()    { return dense_.cend();    }
 
   constexpr bool contains(Key key);
+
+  // false if dense position dPos is a hole holding a free-list link, which
+  // may alias a live key and would fool contains()
+  bool validAt(size_t dPos) {
+    return dPos < dense_.size() && densePosFromKey(dense_[dPos]) == dPos;
+  }
   virtual void remove(Key key);
 
+  // new, empty set of the same type and configuration
+  virtual BaseStorageSet* createEmpty() = 0;
+
+  // moves every key of this set into dst (same type) under remap, in bulk,
+  // and leaves this set empty
+  virtual void mergeInto(BaseStorageSet& dst,
+                         const KeyRemap<Key, keyPrefixBitCount>& remap) = 0;
+
+  // moves the listed keys into dst (same type) under remap
+  virtual void migrateTo(BaseStorageSet& dst, const Key* keys, size_t count,
+                         const KeyRemap<Key, keyPrefixBitCount>& remap) = 0;
+
 protected:
   void resizeContainersForKey(size_t page, size_t offset);
 
+  // appends key at the end of dense_, ignoring the recycling list
+  void appendKey(Key key) {
+    assert(dense_.size() < denseSizeMax() &&
+           "Cannot add item, dense vector is full!");
+
+    auto [page, offset] = pageAndOffsetFromKey(key);
+    resizeContainersForKey(page, offset);
+
+    (*sparse_[page])[offset] = static_cast<BaseKey>(dense_.size());
+    dense_.push_back(key);
+  }
+
+  // no more dense positions than addressable keys, and NullKey is reserved
+  // in the sparse pages that store them
+  size_t denseSizeMax() const {
+    return std::min(pageSize_ * pageCountMax_, static_cast<size_t>(NullKey));
+  }
+
+  void setDensePos(Key key, BaseKey dPos) {
+    auto [page, offset] = pageAndOffsetFromKey(key);
+    (*sparse_[page])[offset] = dPos;
+  }
+
   size_t pageFromKey(Key key) {
     return baseIdentifier(key) / pageSize_;
   }
@@ -126,6 +172,35 @@ remove(Key key) {
   }
 }
 
+template <typename Key, size_t keyPrefixBitCount>
+void BaseStorageSet<Key, keyPrefixBitCount>::
+clear() {
+  // stale entries could alias dense slots that later hold free-list links,
+  // so every sparse entry must be reset. A sparse set is cheaper to reset
+  // key by key, skipping holes whose links are not keys; a dense one with a
+  // bulk fill of each page
+  size_t sparseSize = 0;
+  std::for_each(sparse_.begin(), sparse_.end(), [&sparseSize](auto& page) {
+    if (page)
+      sparseSize += page->size();
+  });
+
+  if (dense_.size() < sparseSize) {
+    for (size_t dPos = 0; dPos < dense_.size(); ++dPos)
+      if (validAt(dPos))
+        setDensePos(dense_[dPos], NullKey);
+  } else {
+    std::for_each(sparse_.begin(), sparse_.end(), [](auto& page) {
+      if (page)
+        std::fill(page->begin(), page->end(), NullKey);
+    });
+  }
+
+  dense_.clear();
+  recyclingHead_ = NullKey;
+  recyclingCount_ = 0;
+}
+
 template <typename Key, size_t keyPrefixBitCount>
 void BaseStorageSet<Key, keyPrefixBitCount>::
 resizeContainersForKey(size_t page, size_t offset) {
@@ -147,6 +222,8 @@ resizeContainersForKey(size_t page, size_t offset) {
   if (!sparse_[page]) {
     sparse_[page] =
       std::make_unique<std::vector<BaseKey>>(minPageSize, NullKey);
+
+    PEBBLE_TRACE_ADD(SparsePagesCreated, 1);
   }
 
   if (offset >= sparse_[static_cast<uint32_t>(page)]->capacity()) {
@@ -185,4 +262,32 @@ struct BaseKeyInfo {
   }
 };
 
+// source key -> destination key table, indexed by the base identifier of the
+// source key, for moving keys between sets; unknown or stale keys map to
+// NullKey
+template <typename Key, size_t keyPrefixBitCount>
+class KeyRemap {
+  using MyBaseKeyInfo = BaseKeyInfo<Key, keyPrefixBitCount>;
+
+public:
+  static constexpr Key NullKey = static_cast<Key>(MyBaseKeyInfo::NullKey);
+
+  void set(Key from, Key to) {
+    auto id = MyBaseKeyInfo::baseIdentifier(from);
+    if (id >= table_.size())
+      table_.resize(size_t(id) + 1, std::make_pair(NullKey, NullKey));
+
+    table_[id] = std::make_pair(from, to);
+  }
+
+  Key operator()(Key from) const {
+    auto id = MyBaseKeyInfo::baseIdentifier(from);
+    return id < table_.size() && table_[id].first == from ?
+        table_[id].second : NullKey;
+  }
+
+private:
+  std::vector<std::pair<Key, Key>> table_;
+};
+
 }
@@ -0,0 +1,113 @@
+//
+//  DoubleBufferedStorage.hpp
+//  PebbleEngine
+//
+
+#pragma once
+
+#include "../Core/PebbleCom.hpp"
+
+
+namespace pebble {
+
+// StorageSet container with a back buffer that receives every write and a
+// front buffer holding the state published by the last swapBuffers(). Both
+// share the set's sparse/dense index, so a dense position addresses the same
+// component in either. Readers on other threads use published() while the
+// owner writes; structural changes (add/remove) and swapBuffers() must
+// happen at a frame boundary when no reader is active. Each slot remembers
+// the swap in which its current owner took it, so a slot filled or recycled
+// since the last swap reads as unpublished instead of returning a default
+// or the previous owner's value.
+template <typename Type>
+class DoubleBufferedStorage {
+public:
+  using value_type     = Type;
+  using iterator       = typename std::vector<Type>::iterator;
+  using const_iterator = typename std::vector<Type>::const_iterator;
+
+  size_t size()  const { return back().size();  }
+  bool   empty() const { return back().empty(); }
+
+  Type&       operator[](size_t pos)       { return back()[pos]; }
+  const Type& operator[](size_t pos) const { return back()[pos]; }
+
+  iterator       begin()        { return back().begin();  }
+  iterator       end()          { return back().end();    }
+  const_iterator cbegin() const { return back().cbegin(); }
+  const_iterator cend()   const { return back().cend();   }
+
+  // new slots are mirrored into the front buffer so positions stay aligned,
+  // the value itself only becomes visible after the next swap
+  void push_back(const Type& value) {
+    back().push_back(value);
+    front().emplace_back();
+    ownedSince_.push_back(swapCount_);
+  }
+
+  void push_back(Type&& value) {
+    back().push_back(std::move(value));
+    front().emplace_back();
+    ownedSince_.push_back(swapCount_);
+  }
+
+  void clear() {
+    buffers_[0].clear();
+    buffers_[1].clear();
+    ownedSince_.clear();
+  }
+
+  // called by StorageSet when a recycled slot is handed to a new key
+  void claim(size_t pos) { ownedSince_[pos] = swapCount_; }
+
+  // moves both buffers of other's slot and its published state into pos,
+  // pos == size() appends; used when components move between registries
+  void transfer(size_t pos, DoubleBufferedStorage& other, size_t otherPos) {
+    auto since = other.isPublished(otherPos) ? 0 : swapCount_;
+
+    if (pos == size()) {
+      back().push_back(std::move(other.back()[otherPos]));
+      front().push_back(std::move(other.front()[otherPos]));
+      ownedSince_.push_back(since);
+    }
+    else {
+      back()[pos] = std::move(other.back()[otherPos]);
+      front()[pos] = std::move(other.front()[otherPos]);
+      ownedSince_[pos] = since;
+    }
+  }
+
+  // false until the slot's current owner has been through a swap
+  bool isPublished(size_t pos) const { return ownedSince_[pos] < swapCount_; }
+
+  const Type& published(size_t pos) const { return front()[pos]; }
+
+  const_iterator publishedBegin() const { return front().cbegin(); }
+  const_iterator publishedEnd()   const { return front().cend();   }
+
+  // publishes the back buffer and copies the published state into the new
+  // back buffer, so in-place updates keep building on the latest values.
+  // carryOver = false skips the O(n) copy and leaves the values from two
+  // swaps ago, only for writers that rewrite every component each frame
+  void swapBuffers(bool carryOver = true) {
+    frontIndex_ ^= 1;
+    ++swapCount_;
+
+    if (carryOver)
+      std::copy(front().begin(), front().end(), back().begin());
+  }
+
+private:
+  std::vector<Type>&       front()       { return buffers_[frontIndex_];     }
+  const std::vector<Type>& front() const { return buffers_[frontIndex_];     }
+  std::vector<Type>&       back()        { return buffers_[frontIndex_ ^ 1]; }
+  const std::vector<Type>& back()  const { return buffers_[frontIndex_ ^ 1]; }
+
+private:
+  std::vector<Type>   buffers_[2];
+  std::vector<size_t> ownedSince_;
+  size_t              frontIndex_ = 0;
+  size_t              swapCount_  = 1;  // 0 marks slots published elsewhere
+};
+
+}
@@ -0,0 +1,351 @@
+//
+//  HierarchyStorageSet.hpp
+//  PebbleEngine
+//
+
+#pragma once
+
+#include "../Core/PebbleCom.hpp"
+#include "StorageSet.hpp"
+
+
+namespace pebble {
+
+// StorageSet that keeps its dense arrays in depth-first order: every key is
+// directly followed by its whole subtree, so a forward pass always visits a
+// parent before its children. Removal leaves a tombstone that is skipped by
+// every pass and dropped by a batched compaction, and keys added through the
+// plain StorageSet interface are appended as roots.
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+class HierarchyStorageSet : public StorageSet<Key, keyPrefixBitCount, Type> {
+  using MyStorageSet = StorageSet<Key, keyPrefixBitCount, Type>;
+  using BaseKey = typename MyStorageSet::BaseKey;
+
+public:
+  static constexpr Key NullParent =
+      static_cast<Key>(BaseKeyInfo<Key, keyPrefixBitCount>::NullKey);
+
+  HierarchyStorageSet(size_t pageSize = defaultPageSize,
+                      size_t pageCountMax  = defaultPageCountMax)
+      : MyStorageSet(pageSize, pageCountMax) {}
+
+  virtual ~HierarchyStorageSet() = default;
+
+  virtual void clear() override {
+    MyStorageSet::clear();
+    parents_.clear();
+    depths_.clear();
+    tombstoneCount_ = 0;
+  }
+
+  virtual Key validCount() override {
+    return MyStorageSet::validCount() - static_cast<Key>(tombstoneCount_);
+  }
+
+  // O(size of key's subtree): the children move up a level in place and
+  // key's slot becomes a tombstone. Tombstones are compacted away in one
+  // O(n) pass once they make up a quarter of the set, so the cost per
+  // removal stays amortized O(1) on top of the subtree walk.
+  virtual void remove(Key key) override;
+
+  virtual BaseStorageSet<Key, keyPrefixBitCount>* createEmpty() override {
+    auto ptr = new HierarchyStorageSet(this->pageSize_, this->pageCountMax_);
+    ptr->references_ = this->references_;
+    return ptr;
+  }
+
+  // the dense order is kept, merged trees end up as roots after dst's own
+  virtual void mergeInto(BaseStorageSet<Key, keyPrefixBitCount>& dst,
+      const KeyRemap<Key, keyPrefixBitCount>& remap) override;
+
+  // parents outside the migrated keys are dropped, making those keys roots
+  virtual void migrateTo(BaseStorageSet<Key, keyPrefixBitCount>& dst,
+      const Key* keys, size_t count,
+      const KeyRemap<Key, keyPrefixBitCount>& remap) override;
+
+  // moves key and its subtree to the end of parent's subtree; a parent that
+  // is not in the set (e.g. NullParent) makes key a root
+  void reparent(Key key, Key parent);
+
+  Key parentOf(Key key);
+  size_t depthOf(Key key);
+
+  // f(Type& value, Type* parentValue) in depth-first order, one linear pass
+  template <typename Functor>
+  void forEachWithParent(Functor&& f);
+
+protected:
+  virtual void dropMoved(Key key) override {
+    syncHierarchy();
+    detach(key);
+  }
+
+private:
+  void syncHierarchy() {
+    parents_.resize(this->dense_.size(), NullParent);
+    depths_.resize(this->dense_.size(), 0);
+  }
+
+  size_t subtreeEnd(size_t dPos) {
+    auto end = dPos + 1;
+    while (end < depths_.size() && depths_[end] > depths_[dPos])
+      ++end;
+
+    return end;
+  }
+
+  bool isTombstone(size_t dPos) { return this->dense_[dPos] == NullParent; }
+
+  void refreshDensePos(size_t first, size_t last) {
+    for (auto dPos = first; dPos < last; ++dPos) {
+      if (!isTombstone(dPos))
+        this->setDensePos(this->dense_[dPos], static_cast<BaseKey>(dPos));
+    }
+  }
+
+  void detach(Key key);
+  void compact();
+  void rotate(size_t first, size_t middle, size_t last);
+
+private:
+  std::vector<Key>    parents_;
+  std::vector<size_t> depths_;
+  size_t              tombstoneCount_ = 0;
+};
+
+
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+void HierarchyStorageSet<Key, keyPrefixBitCount, Type>::
+remove(Key key) {
+  syncHierarchy();
+
+  if (this->contains(key)) {
+    this->indexErase(key);
+    detach(key);
+  }
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+void HierarchyStorageSet<Key, keyPrefixBitCount, Type>::
+mergeInto(BaseStorageSet<Key, keyPrefixBitCount>& dst,
+          const KeyRemap<Key, keyPrefixBitCount>& remap) {
+  auto& out = static_cast<HierarchyStorageSet&>(dst);
+
+  syncHierarchy();
+  out.syncHierarchy();
+
+  // keys without a remap entry are dropped as remove() would, handing their
+  // children to the grandparent so parents_ and depths_ stay aligned with
+  // the slots the base merge moves
+  std::vector<Key> unmapped;
+  for (size_t dPos = 0; dPos < this->dense_.size(); ++dPos) {
+    if (!isTombstone(dPos) &&
+        remap(this->dense_[dPos]) == KeyRemap<Key, keyPrefixBitCount>::NullKey)
+      unmapped.push_back(this->dense_[dPos]);
+  }
+
+  for (auto key : unmapped)
+    detach(key);
+
+  // the base merge moves every slot, tombstones must not come along
+  if (tombstoneCount_ > 0)
+    compact();
+
+  // clear() in the base merge drops them, remapped below
+  auto parents = std::move(parents_);
+  auto depths = std::move(depths_);
+
+  MyStorageSet::mergeInto(dst, remap);
+
+  for (auto parent : parents)
+    out.parents_.push_back(parent == NullParent ? NullParent : remap(parent));
+
+  out.depths_.insert(out.depths_.end(), depths.begin(), depths.end());
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+void HierarchyStorageSet<Key, keyPrefixBitCount, Type>::
+migrateTo(BaseStorageSet<Key, keyPrefixBitCount>& dst,
+          const Key* keys, size_t count,
+          const KeyRemap<Key, keyPrefixBitCount>& remap) {
+  auto& out = static_cast<HierarchyStorageSet&>(dst);
+  std::vector<std::pair<Key, Key>> links;
+
+  for (size_t i = 0; i < count; ++i) {
+    auto parent = parentOf(keys[i]);
+    if (this->contains(keys[i]) && parent != NullParent)
+      links.emplace_back(remap(keys[i]), remap(parent));
+  }
+
+  MyStorageSet::migrateTo(dst, keys, count, remap);
+
+  // keys arrive as roots, links are restored once every key is in place
+  for (auto [child, parent] : links)
+    out.reparent(child, parent);
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+void HierarchyStorageSet<Key, keyPrefixBitCount, Type>::
+detach(Key key) {
+  if (this->contains(key)) {
+    auto dPos = this->densePosFromKey(key);
+    auto last = subtreeEnd(dPos);
+
+    // children are handed to the grandparent, the subtree moves up a level;
+    // the tombstone keeps its depth and acts as a childless leaf until the
+    // next compaction
+    for (auto i = dPos + 1; i < last; ++i) {
+      --depths_[i];
+      if (parents_[i] == key)
+        parents_[i] = parents_[dPos];
+    }
+
+    this->dense_[dPos] = NullParent;
+    this->setDensePos(key, this->NullKey);
+
+    if (++tombstoneCount_ * 4 > this->dense_.size())
+      compact();
+  }
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+void HierarchyStorageSet<Key, keyPrefixBitCount, Type>::
+compact() {
+  size_t last = 0;
+  size_t first = this->dense_.size();
+
+  for (size_t dPos = 0; dPos < this->dense_.size(); ++dPos) {
+    if (isTombstone(dPos)) {
+      first = std::min(first, dPos);
+      continue;
+    }
+
+    if (last != dPos) {
+      this->dense_[last] = this->dense_[dPos];
+      this->storage_[last] = std::move(this->storage_[dPos]);
+      parents_[last] = parents_[dPos];
+      depths_[last] = depths_[dPos];
+    }
+
+    ++last;
+  }
+
+  this->dense_.resize(last);
+  this->storage_.erase(this->storage_.begin() + last, this->storage_.end());
+  parents_.resize(last);
+  depths_.resize(last);
+  tombstoneCount_ = 0;
+
+  refreshDensePos(std::min(first, last), last);
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+void HierarchyStorageSet<Key, keyPrefixBitCount, Type>::
+reparent(Key key, Key parent) {
+  syncHierarchy();
+
+  if (!this->contains(key))
+    return;
+
+  auto first = this->densePosFromKey(key);
+  auto last = subtreeEnd(first);
+  size_t target, depth;
+
+  if (this->contains(parent)) {
+    auto pPos = this->densePosFromKey(parent);
+    if (pPos >= first && pPos < last) {
+      assert(false && "Cannot parent a key to its own subtree!");
+      return;
+    }
+
+    target = subtreeEnd(pPos);
+    depth = depths_[pPos] + 1;
+  }
+  else {
+    parent = NullParent;
+    target = this->dense_.size();
+    depth = 0;
+  }
+
+  if (parents_[first] == parent)
+    return;
+
+  auto oldDepth = depths_[first];
+  for (auto i = first; i < last; ++i)
+    depths_[i] = depths_[i] - oldDepth + depth;
+
+  parents_[first] = parent;
+
+  if (target > last)
+    rotate(first, last, target);
+  else if (target < first)
+    rotate(target, first, last);
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+Key HierarchyStorageSet<Key, keyPrefixBitCount, Type>::
+parentOf(Key key) {
+  syncHierarchy();
+  return this->contains(key) ?
+      parents_[this->densePosFromKey(key)] : NullParent;
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+size_t HierarchyStorageSet<Key, keyPrefixBitCount, Type>::
+depthOf(Key key) {
+  syncHierarchy();
+  return this->contains(key) ? depths_[this->densePosFromKey(key)] : 0;
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+template <typename Functor>
+void HierarchyStorageSet<Key, keyPrefixBitCount, Type>::
+forEachWithParent(Functor&& f) {
+  syncHierarchy();
+
+  // depth-first order guarantees ancestors[depth - 1] is the parent
+  std::vector<Type*> ancestors;
+
+  for (size_t dPos = 0; dPos < this->dense_.size(); ++dPos) {
+    if (isTombstone(dPos))
+      continue;
+
+    auto depth = depths_[dPos];
+    if (depth >= ancestors.size())
+      ancestors.resize(depth + 1, nullptr);
+
+    ancestors[depth] = &this->storage_[dPos];
+    f(this->storage_[dPos], depth > 0 ? ancestors[depth - 1] : nullptr);
+  }
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+void HierarchyStorageSet<Key, keyPrefixBitCount, Type>::
+rotate(size_t first, size_t middle, size_t last) {
+  std::rotate(this->dense_.begin() + first, this->dense_.begin() + middle,
+              this->dense_.begin() + last);
+  std::rotate(this->storage_.begin() + first, this->storage_.begin() + middle,
+              this->storage_.begin() + last);
+  std::rotate(parents_.begin() + first, parents_.begin() + middle,
+              parents_.begin() + last);
+  std::rotate(depths_.begin() + first, depths_.begin() + middle,
+              depths_.begin() + last);
+
+  refreshDensePos(first, last);
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type>
+HierarchyStorageSet<Key, keyPrefixBitCount, Type>*
+hierarchy_cast(BaseStorageSet<Key, keyPrefixBitCount>* basePtr) {
+
+  if (basePtr && typeid(*basePtr) ==
+      typeid(HierarchyStorageSet<Key, keyPrefixBitCount, Type>)) {
+
+    return static_cast<HierarchyStorageSet<Key, keyPrefixBitCount, Type>*>(
+        basePtr);
+  }
+  else
+    return nullptr;
+}
+
+}
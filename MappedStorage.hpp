@@ -0,0 +1,146 @@
+//
+//  MappedStorage.hpp
+//  PebbleEngine
+//
+
+#pragma once
+
+#include "../Core/PebbleCom.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+namespace pebble {
+
+// StorageSet container backed by a file-backed shared mapping instead of the
+// heap, so cold components are paged out to that file rather than held in
+// RAM. Grows in whole-page extents; elements must be trivially copyable since
+// they are relocated by remapping the file. Pointers into the storage are
+// invalidated by growth, just like std::vector. Where std::vector would throw
+// std::bad_alloc, a failure to create, grow or map the backing file throws
+// std::system_error and leaves the storage unchanged.
+template <typename Type>
+class MappedStorage {
+  static_assert(std::is_trivially_copyable_v<Type>,
+                "MappedStorage requires a trivially copyable type!");
+
+public:
+  using value_type     = Type;
+  using iterator       = Type*;
+  using const_iterator = const Type*;
+
+  // anonymous, already unlinked file in $TMPDIR
+  MappedStorage() {
+    const char* dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir ? dir : "/tmp") + "/pebbleXXXXXX";
+
+    fd_ = mkstemp(path.data());
+    if (fd_ == -1)
+      throw std::system_error(errno, std::generic_category(),
+                              "Cannot create backing file");
+
+    unlink(path.c_str());
+  }
+
+  // named file, truncated on open
+  explicit MappedStorage(const char* path)
+      : fd_(open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) {
+    if (fd_ == -1)
+      throw std::system_error(errno, std::generic_category(),
+                              "Cannot open backing file");
+  }
+
+  MappedStorage(const MappedStorage&) = delete;
+  MappedStorage& operator=(const MappedStorage&) = delete;
+
+  ~MappedStorage() {
+    if (data_)
+      munmap(data_, bytes_);
+    close(fd_);
+  }
+
+  size_t size()     const { return size_; }
+  size_t capacity() const { return bytes_ / sizeof(Type); }
+  bool   empty()    const { return size_ == 0; }
+
+  Type&       operator[](size_t pos)       { return data_[pos]; }
+  const Type& operator[](size_t pos) const { return data_[pos]; }
+
+  iterator       begin()        { return data_;         }
+  iterator       end()          { return data_ + size_; }
+  const_iterator cbegin() const { return data_;         }
+  const_iterator cend()   const { return data_ + size_; }
+
+  // reserve() throws before anything is written if the file cannot grow
+  void push_back(const Type& value) {
+    if (size_ == capacity())
+      reserve(size_ + 1);
+
+    new (data_ + size_) Type(value);
+    ++size_;
+  }
+
+  // keeps the mapping, the file pages are simply reused
+  void clear() { size_ = 0; }
+
+  void reserve(size_t count);
+
+private:
+  int    fd_    = -1;
+  Type*  data_  = nullptr;
+  size_t size_  = 0;
+  size_t bytes_ = 0;
+};
+
+
+template <typename Type>
+void MappedStorage<Type>::
+reserve(size_t count) {
+  if (count <= capacity())
+    return;
+
+  static const size_t extent = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+  auto bytes = std::max(count * sizeof(Type), bytes_ * 2);
+  bytes = (bytes + extent - 1) / extent * extent;
+
+  if (ftruncate(fd_, static_cast<off_t>(bytes)) != 0)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot grow backing file");
+
+  // the contents live in the file, so a mapping of the larger file keeps
+  // them; the old mapping is only released once the new one exists
+#ifdef __linux__
+  auto ptr = data_ ? mremap(data_, bytes_, bytes, MREMAP_MAYMOVE) :
+      mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+#else
+  auto ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+#endif
+
+  if (ptr == MAP_FAILED) {
+    auto error = errno;
+
+    // best effort: a file left larger than the mapping is harmless, the next
+    // reserve() sizes it again
+    [[maybe_unused]] auto rolledBack =
+        ftruncate(fd_, static_cast<off_t>(bytes_)) == 0;
+    throw std::system_error(error, std::generic_category(),
+                            "Cannot map backing file");
+  }
+
+#ifndef __linux__
+  if (data_)
+    munmap(data_, bytes_);
+#endif
+
+  data_  = static_cast<Type*>(ptr);
+  bytes_ = bytes;
+}
+
+}
@@ -0,0 +1,153 @@
+//
+//  PooledStorage.hpp
+//  PebbleEngine
+//
+
+#pragma once
+
+#include "../Core/PebbleCom.hpp"
+
+
+namespace pebble {
+
+static constexpr size_t defaultPoolBlockSize = 256;
+
+// StorageSet container that constructs its elements in fixed-size blocks and
+// never moves them, so component addresses stay stable without a heap
+// allocation per component (the reason to store std::unique_ptr<T>). Slots
+// freed by remove() are reused through the set's dense recycling list, and
+// blocks are kept on clear() for reuse. Iteration is contiguous within each
+// block.
+template <typename Type, size_t blockSize = defaultPoolBlockSize>
+class PooledStorage {
+  static_assert(blockSize > 0 && (blockSize & (blockSize - 1)) == 0,
+                "Pool block size must be a power of 2!");
+
+  struct alignas(Type) Block {
+    unsigned char bytes[sizeof(Type) * blockSize];
+  };
+
+  template <typename Value>
+  class Iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = std::remove_const_t<Value>;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = Value*;
+    using reference         = Value&;
+
+    Iterator() = default;
+    Iterator(const PooledStorage* pool, size_t pos)
+        : pool_(pool), pos_(pos), ptr_(at(pos)), blockEnd_(endOf(pos)) {}
+
+    reference operator*()  const { return *ptr_; }
+    pointer   operator->() const { return ptr_;  }
+
+    Iterator& operator++() {
+      ++pos_;
+      if (++ptr_ == blockEnd_) {
+        ptr_ = at(pos_);
+        blockEnd_ = endOf(pos_);
+      }
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      auto it = *this;
+      ++(*this);
+      return it;
+    }
+
+    bool operator==(const Iterator& other) const { return pos_ == other.pos_; }
+    bool operator!=(const Iterator& other) const { return pos_ != other.pos_; }
+
+  private:
+    pointer at(size_t pos) const {
+      return pos < pool_->size_ ?
+          &const_cast<PooledStorage&>(*pool_)[pos] : nullptr;
+    }
+
+    pointer endOf(size_t pos) const {
+      return pos < pool_->size_ ? at(pos) + (blockSize - modPow2(pos, blockSize))
+                                : nullptr;
+    }
+
+    const PooledStorage* pool_ = nullptr;
+    size_t  pos_      = 0;
+    pointer ptr_      = nullptr;
+    pointer blockEnd_ = nullptr;
+  };
+
+public:
+  using value_type     = Type;
+  using iterator       = Iterator<Type>;
+  using const_iterator = Iterator<const Type>;
+
+  PooledStorage() = default;
+  PooledStorage(const PooledStorage&) = delete;
+  PooledStorage& operator=(const PooledStorage&) = delete;
+
+  ~PooledStorage() { clear(); }
+
+  size_t size()     const { return size_; }
+  size_t capacity() const { return blocks_.size() * blockSize; }
+  bool   empty()    const { return size_ == 0; }
+
+  Type& operator[](size_t pos) {
+    return reinterpret_cast<Type*>(blocks_[pos / blockSize]->bytes)
+        [modPow2(pos, blockSize)];
+  }
+
+  const Type& operator[](size_t pos) const {
+    return reinterpret_cast<const Type*>(blocks_[pos / blockSize]->bytes)
+        [modPow2(pos, blockSize)];
+  }
+
+  iterator       begin()        { return iterator(this, 0);           }
+  iterator       end()          { return iterator(this, size_);       }
+  const_iterator cbegin() const { return const_iterator(this, 0);     }
+  const_iterator cend()   const { return const_iterator(this, size_); }
+
+  void push_back(const Type& value) { new (slot()) Type(value); ++size_; }
+  void push_back(Type&& value) { new (slot()) Type(std::move(value)); ++size_; }
+
+  void clear() {
+    if constexpr (!std::is_trivially_destructible_v<Type>) {
+      for (size_t pos = 0; pos < size_; ++pos)
+        (*this)[pos].~Type();
+    }
+
+    size_ = 0;
+  }
+
+private:
+  void* slot() {
+    if (size_ == capacity())
+      blocks_.push_back(std::make_unique<Block>());
+
+    return &(*this)[size_];
+  }
+
+private:
+  std::vector<std::unique_ptr<Block>> blocks_;
+  size_t size_ = 0;
+};
+
+// PooledStorage restricted to trivially destructible components, so that
+// clearing the whole set at frame end only rewinds the arena. Pick it for
+// components that live for a single frame and reset them all at once with
+// Registry::clearTransientComponents().
+template <typename Type, size_t blockSize = defaultPoolBlockSize>
+class TransientStorage : public PooledStorage<Type, blockSize> {
+  static_assert(std::is_trivially_destructible_v<Type>,
+                "TransientStorage requires a trivially destructible type!");
+};
+
+template <typename Storage>
+struct is_transient_storage : std::false_type {};
+
+template <typename Type, size_t blockSize>
+struct is_transient_storage<TransientStorage<Type, blockSize>>
+    : std::true_type {};
+
+}
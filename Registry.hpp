@@ -9,20 +9,59 @@
 
 #include "../Core/PebbleCom.hpp"
 #include "StorageSet.hpp"
+#include "HierarchyStorageSet.hpp"
+#include "MappedStorage.hpp"
+#include "PooledStorage.hpp"
+#include "DoubleBufferedStorage.hpp"
+
+#include <chrono>
 
 
 namespace pebble {
 
-using Entity = uint64_t;
-using EntityID = uint32_t;
-using EntityGeneration = uint32_t;
-using Component = EntityID;
+using Component = uint32_t;
+
+// handle layout: the width of Entity and how many of its high bits hold the
+// generation, the remaining low bits are the ID
+template <typename EntityType, size_t generationBits>
+struct EntityTraits {
+  static_assert(generationBits > 0 && generationBits < sizeof(EntityType) * 8,
+                "Entity needs both generation and identifier bits!");
+
+  using Entity = EntityType;
+  using EntityID = typename BaseKeyInfo<Entity, generationBits>::type;
+  using EntityGeneration = typename std::conditional<
+    generationBits <= 16,
+    uint16_t,
+    typename std::conditional<generationBits <= 32, uint32_t, uint64_t>::type
+  >::type;
+
+  static constexpr size_t generationBitCount = generationBits;
+  static constexpr size_t identifierBitCount =
+      (sizeof(Entity) * 8) - generationBitCount;
+};
+
+using DefaultEntityTraits = EntityTraits<uint64_t, 32>;
 
-constexpr size_t generationBitCount = 32;
-constexpr size_t identifierBitCount = (sizeof(Entity) * 8) - generationBitCount;
+// 2^20 IDs and 12 generation bits, halves key memory compared to the default;
+// component storages size their limits from identifierBitCount
+using CompactEntityTraits = EntityTraits<uint32_t, 12>;
+
+// container holding every T of a registry, specialize to pick another
+// storage policy, e.g. MappedStorage<T> for large, rarely touched components,
+// PooledStorage<T> for components that need stable addresses,
+// TransientStorage<T> for components that only live for one frame, or
+// DoubleBufferedStorage<T> for components read by other threads mid-frame
+template <typename T>
+struct component_storage {
+  using type = std::vector<T>;
+};
 
 template <typename T>
-using ComponentStorageSet = StorageSet<Entity, generationBitCount, T>;
+using component_storage_t = typename component_storage<T>::type;
+
+// number of entity IDs a worker claims at once when appending concurrently
+static constexpr size_t entityBlockSize = 64;
 
 struct indexGenerator {
   static Component getNextIndex() {
@@ -44,37 +83,147 @@ struct uniqueIndex {
 
 
 
-static constexpr EntityID entityIdentifier(Entity entity) {
-  return entity & (maxValue<Entity>() >> generationBitCount);
-}
+// default number of dense slots a budgeted pass scans between clock checks
+static constexpr size_t budgetClockInterval = 64;
 
-static constexpr EntityGeneration entityGeneration(Entity entity) {
-  return entity >> identifierBitCount;
-}
+// limits for one call of a budgeted forEach, whichever is hit first; the
+// clock is read every clockInterval scanned slots, matching or not, so use 1
+// when each callback is expensive enough to blow the budget on its own
+struct IterationBudget {
+  size_t                    maxEntities   = maxValue<size_t>();
+  std::chrono::microseconds maxTime       = std::chrono::microseconds::max();
+  size_t                    clockInterval = budgetClockInterval;
+};
 
-static constexpr Entity entityCombine(EntityID id, EntityGeneration gen) {
-  return (Entity)gen << identifierBitCount | id;
-}
+// dense position a budgeted pass resumes from, keep one per system; entities
+// present for the whole pass are visited exactly once, entities added or
+// removed in between calls are picked up or skipped safely. Hierarchy
+// storages are the exception: reparenting or their removal compaction
+// reorders the dense arrays, so a pass over one that is modified between
+// calls may skip or repeat entities.
+struct IterationCursor {
+  size_t position = 0;
+};
 
-static constexpr Entity NullEntity = entityCombine(maxValue<EntityID>(), 0);
+// tag naming the resources a forEach hands to its functor before the
+// components, e.g. forEach<position>(Resources<Time>{}, f)
+template <typename... Rs>
+struct Resources {};
 
-class Registry {
+template <typename Traits = DefaultEntityTraits>
+class BasicRegistry {
 public:
+  using Entity           = typename Traits::Entity;
+  using EntityID         = typename Traits::EntityID;
+  using EntityGeneration = typename Traits::EntityGeneration;
+
+  static constexpr size_t generationBitCount = Traits::generationBitCount;
+  static constexpr size_t identifierBitCount = Traits::identifierBitCount;
+
+  static constexpr EntityID entityIdentifier(Entity entity) {
+    return static_cast<EntityID>(
+        entity & (maxValue<Entity>() >> generationBitCount));
+  }
+
+  static constexpr EntityGeneration entityGeneration(Entity entity) {
+    return static_cast<EntityGeneration>(entity >> identifierBitCount);
+  }
+
+  static constexpr Entity entityCombine(EntityID id, EntityGeneration gen) {
+    return static_cast<Entity>((Entity)gen << identifierBitCount | id);
+  }
+
+  static constexpr Entity NullEntity = entityCombine(
+      static_cast<EntityID>(maxValue<Entity>() >> generationBitCount), 0);
+
+  // sparse pages a component storage may grow to, enough to address every
+  // identifier of the layout; pages are still only allocated on use
+  static constexpr size_t storagePageCountMax = std::max(
+      (identifierBitCount < 64 ? size_t(1) << identifierBitCount :
+                                 maxValue<size_t>()) / defaultPageSize,
+      size_t(1));
+
+  template <typename T>
+  using ComponentStorageSet =
+      StorageSet<Entity, generationBitCount, T, component_storage_t<T>>;
+
+  template <typename T>
+  using ComponentHierarchySet =
+      HierarchyStorageSet<Entity, generationBitCount, T>;
+
+  template <typename T, typename Extractor>
+  using ComponentHashIndex =
+      HashStorageIndex<Entity, generationBitCount, T, std::decay_t<Extractor>>;
+
+  template <typename T, typename Extractor>
+  using ComponentOrderedIndex =
+      OrderedStorageIndex<Entity, generationBitCount, T, std::decay_t<Extractor>>;
+
+  // source entity -> entity created for it by merge() / migrate()
+  using EntityRemap = KeyRemap<Entity, generationBitCount>;
+
+  // range of entity IDs reserved by a single worker thread for concurrent
+  // creation; owned by the worker, refilled from the registry when exhausted
+  struct EntityBlock {
+    EntityID next = 0;
+    EntityID end  = 0;
+  };
+
   void resetRegistry();
 
+  // not thread-safe, may grow the entity table
   Entity createEntity(bool recycleIfAvailable = true);
+
+  // thread-safe, never grows the entity table; returns NullEntity once the
+  // capacity set by reserveEntities() is exhausted
+  Entity createEntity(EntityBlock& block, bool recycleIfAvailable = true);
+
+  // thread-safe, lock-free pop from the recycling stack
   Entity recycleEntity();
+
+  // must run at a sync point, removes the entity's components
   void deleteEntity(Entity entity);
 
+  // sync point only: makes room for count entities in total
+  void reserveEntities(size_t count);
+
+  // thread-safe, returns a worker's unused IDs to the recycling stack
+  void releaseEntityBlock(EntityBlock& block);
+
   template <typename T>
   ComponentStorageSet<T>* createComponentStorage();
 
   template <typename T>
   ComponentStorageSet<T>* getComponentStorage();
 
+  // keeps T in depth-first parent/child order, must be created before the
+  // first T is added
+  template <typename T>
+  ComponentHierarchySet<T>* createHierarchyStorage();
+
+  template <typename T>
+  ComponentHierarchySet<T>* getHierarchyStorage();
+
+  // secondary index on extractor(const T&), maintained by the add/set/remove
+  // component calls; answers value lookups with Entity handles
+  template <typename T, typename Extractor>
+  ComponentHashIndex<T, Extractor>* createHashIndex(Extractor&& extractor);
+
+  // as createHashIndex, additionally answers range queries
+  template <typename T, typename Extractor>
+  ComponentOrderedIndex<T, Extractor>* createOrderedIndex(Extractor&& extractor);
+
   template <typename T>
   T* getComponent(Entity entity);
 
+  // out[i] = getComponent<T>(entities[i]), with the storage looked up once
+  // for the whole batch instead of once per entity
+  template <typename T>
+  void getComponents(const Entity* entities, size_t count, T** out);
+
+  template <typename T>
+  void getComponents(const std::vector<Entity>& entities, std::vector<T*>& out);
+
   template <typename T>
   void setComponent(Entity entity, const T& data);
 
@@ -93,7 +242,72 @@ public:
   template <typename T>
   void removeComponent(Entity entity);
 
+  // removes every T at once, keeping the allocated pages
+  template <typename T>
+  void clearComponents();
+
+  // clears every component stored in a TransientStorage, call at frame end
+  void clearTransientComponents();
+
+  // DoubleBufferedStorage<T> only: publishes this frame's writes, call at a
+  // frame boundary while no reader is active; see
+  // DoubleBufferedStorage::swapBuffers for carryOver
+  template <typename T>
+  void swapComponentBuffers(bool carryOver = true);
+
+  // DoubleBufferedStorage<T> only: last published value, safe to read while
+  // the owning thread writes the back buffer; nullptr if entity has had no
+  // T through a swap yet
+  template <typename T>
+  const T* getPublishedComponent(Entity entity);
+
+  // one instance of R per registry, stored in a slot table indexed by the
+  // same type index as the components; replaces an existing R
+  template <typename R, typename... Args>
+  R* emplaceResource(Args&&... args);
+
+  template <typename R>
+  R* getResource();
+
+  template <typename R>
+  void removeResource();
+
+  // parent == NullEntity (or without a T) makes entity a root
+  template <typename T>
+  void setParent(Entity entity, Entity parent);
+
+  template <typename T>
+  Entity getParent(Entity entity);
+
+  // Entity member of T rewritten when T is moved by merge() / migrate();
+  // registered on the source registry
+  template <typename T>
+  void registerEntityReference(Entity T::* member);
+
+  // sync point on both registries: moves every entity of src into this
+  // registry under a new ID, storage by storage in bulk, and leaves src
+  // empty. References to entities that were not live in src become
+  // NullEntity. If a component is stored with different storage types in
+  // the two registries, nothing is moved and the remap is empty.
+  EntityRemap merge(BasicRegistry&& src);
+
+  // sync point on both registries: moves entities and their components to
+  // dst and deletes them here. References to entities outside the moved set
+  // become NullEntity. Fails like merge() on mismatched storage types.
+  EntityRemap migrate(const std::vector<Entity>& entities, BasicRegistry& dst);
+
 private:
+  bool reserveEntityBlock(EntityBlock& block);
+  void pushRecycledEntity(EntityID id, EntityGeneration gen);
+  void growEntities(size_t count);
+
+  // true if every storage of src is missing here or of the same type
+  bool compatibleStorages(BasicRegistry& src);
+
+  // the storage for index, created like src's if this registry has none
+  BaseStorageSet<Entity, generationBitCount>* adoptStorage(BasicRegistry& src,
+                                                           Component index);
+
   template <size_t k, typename T>
   size_t smallestComponent();
 
@@ -142,7 +356,38 @@ public:
   template <typename... Ts, typename Functor>
   std::enable_if_t<(sizeof...(Ts) > 1), void> forEachWithEntity(Functor&& f);
 
+  // f(Rs&..., Ts&...), the resources are looked up once per call
+  template <typename... Ts, typename... Rs, typename Functor>
+  void forEach(Resources<Rs...>, Functor&& f);
+
+  // f(Entity, Rs&..., Ts&...)
+  template <typename... Ts, typename... Rs, typename Functor>
+  void forEachWithEntity(Resources<Rs...>, Functor&& f);
+
+  // DoubleBufferedStorage<T> only: f(Entity, const T&) over the published
+  // buffer, skipping components that have not been through a swap yet
+  template <typename T, typename Functor>
+  void forEachPublished(Functor&& f);
+
+  // f(T& value, T* parentValue), parents are always visited first
+  template <typename T, typename Functor>
+  void forEachWithParent(Functor&& f);
+
+  // f(T&, Ts&...) over T's dense order, stopping when budget is spent;
+  // returns true once the pass is complete and the cursor has been rewound
+  template <typename T, typename... Ts, typename Functor>
+  bool forEachBudgeted(IterationCursor& cursor, const IterationBudget& budget,
+                       Functor&& f);
+
+  template <typename T, typename... Ts, typename Functor>
+  bool forEachWithEntityBudgeted(IterationCursor& cursor,
+                                 const IterationBudget& budget, Functor&& f);
+
 private:
+  template <bool withEntity, typename T, typename... Ts, typename Functor>
+  bool budgetedPass(IterationCursor& cursor, const IterationBudget& budget,
+                    Functor& f);
+
   template <typename T>
   void componentList(std::vector<Component>& list);
 
@@ -174,33 +419,276 @@ private:
 private:
   StorageSet<Component, 0,
       std::unique_ptr<BaseStorageSet<Entity, generationBitCount>>> components_;
+  std::vector<Component> transientComponents_;
+  std::vector<std::shared_ptr<void>> resources_;
 
-  std::vector<Entity> entities_;
-  EntityID            entityRecyclingHead_ = entityIdentifier(NullEntity);
-  size_t              entityRecyclingCount_ = 0;
+  // slots hold the live handle, or the next free ID and the generation to
+  // hand out when the slot is on the recycling stack
+  std::vector<std::atomic<Entity>> entities_;
+  std::atomic<EntityID>            entityCount_ = 0;
+
+  // tagged with the generation of the head slot so a pop racing against a
+  // delete/re-push of the same ID fails its CAS (ABA)
+  std::atomic<Entity>              entityRecyclingHead_ = NullEntity;
 };
 
+template <typename Traits>
+void BasicRegistry<Traits>::resetRegistry() {
+  components_.clear();
+  transientComponents_.clear();
+  resources_.clear();
+  entities_.clear();
+  entityCount_.store(0, std::memory_order_relaxed);
+  entityRecyclingHead_.store(NullEntity, std::memory_order_relaxed);
+}
+
+template <typename Traits>
+auto BasicRegistry<Traits>::createEntity(bool recycleIfAvailable) -> Entity {
+  PEBBLE_TRACE_SCOPE("Registry::createEntity");
+
+  auto e = recycleIfAvailable ? recycleEntity() : NullEntity;
+
+  if (e == NullEntity) {
+    auto id = entityCount_.fetch_add(1, std::memory_order_relaxed);
+    if (id >= entities_.size())
+      growEntities(nextPow2(static_cast<size_t>(id) + 1));
+
+    e = entityCombine(id, 0);
+    entities_[id].store(e, std::memory_order_relaxed);
+  }
+
+  return e;
+}
+
+template <typename Traits>
+auto BasicRegistry<Traits>::createEntity(EntityBlock& block, bool recycleIfAvailable) -> Entity {
+  PEBBLE_TRACE_SCOPE("Registry::createEntity");
+
+  auto e = recycleIfAvailable ? recycleEntity() : NullEntity;
+
+  if (e == NullEntity &&
+      (block.next < block.end || reserveEntityBlock(block))) {
+    auto id = block.next++;
+    e = entityCombine(id, 0);
+    entities_[id].store(e, std::memory_order_release);
+  }
+
+  return e;
+}
+
+template <typename Traits>
+auto BasicRegistry<Traits>::recycleEntity() -> Entity {
+  auto head = entityRecyclingHead_.load(std::memory_order_acquire);
+
+  while (entityIdentifier(head) != entityIdentifier(NullEntity)) {
+    auto id = entityIdentifier(head);
+    auto nextId = entityIdentifier(entities_[id].load(std::memory_order_relaxed));
+    auto next = nextId == entityIdentifier(NullEntity) ? NullEntity :
+        entityCombine(nextId, entityGeneration(
+            entities_[nextId].load(std::memory_order_relaxed)));
+
+    if (entityRecyclingHead_.compare_exchange_weak(head, next,
+          std::memory_order_acq_rel, std::memory_order_acquire)) {
+      auto e = entityCombine(id, entityGeneration(head));
+      entities_[id].store(e, std::memory_order_release);
+
+      return e;
+    }
+  }
+
+  return NullEntity;
+}
+
+template <typename Traits>
+void BasicRegistry<Traits>::deleteEntity(Entity entity) {
+  PEBBLE_TRACE_SCOPE("Registry::deleteEntity");
+
+  auto id = entityIdentifier(entity);
+  if (id < entities_.size() &&
+      entity == entities_[id].load(std::memory_order_acquire)) {
+    pushRecycledEntity(id, entityGeneration(entity) + 1);
+
+    std::for_each(components_.begin(), components_.end(),
+      [entity](auto& component)
+    {
+      component->remove(entity);
+    });
+  }
+}
+
+template <typename Traits>
+void BasicRegistry<Traits>::clearTransientComponents() {
+  PEBBLE_TRACE_SCOPE("Registry::clearTransientComponents");
+
+  std::for_each(transientComponents_.begin(), transientComponents_.end(),
+    [this](auto index)
+  {
+    auto ptr = components_.get(index);
+    if (ptr)
+      ptr->clear();
+  });
+}
+
+template <typename Traits>
+void BasicRegistry<Traits>::reserveEntities(size_t count) {
+  if (count > entities_.size())
+    growEntities(count);
+}
+
+template <typename Traits>
+void BasicRegistry<Traits>::releaseEntityBlock(EntityBlock& block) {
+  for (; block.next < block.end; ++block.next)
+    pushRecycledEntity(block.next, 0);
+}
+
+template <typename Traits>
+bool BasicRegistry<Traits>::reserveEntityBlock(EntityBlock& block) {
+  auto capacity = static_cast<EntityID>(
+      std::min(entities_.size(), size_t(entityIdentifier(NullEntity))));
+  auto first = entityCount_.load(std::memory_order_relaxed);
+  EntityID last;
+
+  do {
+    if (first >= capacity)
+      return false;
+
+    last = static_cast<EntityID>(
+        std::min(size_t(first) + entityBlockSize, size_t(capacity)));
+  } while (!entityCount_.compare_exchange_weak(first, last,
+             std::memory_order_relaxed));
+
+  block.next = first;
+  block.end = last;
+
+  return true;
+}
+
+template <typename Traits>
+void BasicRegistry<Traits>::pushRecycledEntity(EntityID id, EntityGeneration gen) {
+  auto head = entityRecyclingHead_.load(std::memory_order_relaxed);
+
+  do {
+    entities_[id].store(entityCombine(entityIdentifier(head), gen),
+                        std::memory_order_relaxed);
+  } while (!entityRecyclingHead_.compare_exchange_weak(head,
+             entityCombine(id, gen),
+             std::memory_order_release, std::memory_order_relaxed));
+}
+
+template <typename Traits>
+void BasicRegistry<Traits>::growEntities(size_t count) {
+  std::vector<std::atomic<Entity>> grown(count);
+
+  for (size_t i = 0; i < count; ++i) {
+    grown[i].store(i < entities_.size() ?
+        entities_[i].load(std::memory_order_relaxed) : NullEntity,
+        std::memory_order_relaxed);
+  }
+
+  entities_.swap(grown);
+}
+
+template <typename Traits>
 template <typename T>
-ComponentStorageSet<T>* Registry::createComponentStorage() {
-  components_.add(uniqueIndex<T>(), new ComponentStorageSet<T>());
+auto BasicRegistry<Traits>::createComponentStorage()
+    -> ComponentStorageSet<T>* {
+  components_.add(uniqueIndex<T>(),
+                  new ComponentStorageSet<T>(defaultPageSize, storagePageCountMax));
+
+  if constexpr (is_transient_storage<component_storage_t<T>>::value)
+    transientComponents_.push_back(uniqueIndex<T>());
+
   return getComponentStorage<T>();
 }
 
+template <typename Traits>
 template <typename T>
-ComponentStorageSet<T>* Registry::getComponentStorage() {
+auto BasicRegistry<Traits>::getComponentStorage()
+    -> ComponentStorageSet<T>* {
   auto ptr = components_.get(uniqueIndex<T>());
-  auto ret = storage_cast<Entity, generationBitCount, T>(ptr);
+  auto ret = storage_cast<Entity, generationBitCount, T,
+                          component_storage_t<T>>(ptr);
   return ret ? ret : nullptr;
 }
 
+template <typename Traits>
+template <typename T>
+auto BasicRegistry<Traits>::createHierarchyStorage()
+    -> ComponentHierarchySet<T>* {
+  static_assert(std::is_same_v<component_storage_t<T>, std::vector<T>>,
+                "Hierarchy storage requires the default storage policy!");
+
+  if (!getComponentStorage<T>())
+    components_.add(uniqueIndex<T>(),
+        new ComponentHierarchySet<T>(defaultPageSize, storagePageCountMax));
+
+  return getHierarchyStorage<T>();
+}
+
+template <typename Traits>
+template <typename T>
+auto BasicRegistry<Traits>::getHierarchyStorage()
+    -> ComponentHierarchySet<T>* {
+  auto ptr = components_.get(uniqueIndex<T>());
+  return hierarchy_cast<Entity, generationBitCount, T>(ptr);
+}
+
+template <typename Traits>
+template <typename T, typename Extractor>
+auto BasicRegistry<Traits>::createHashIndex(Extractor&& extractor)
+    -> ComponentHashIndex<T, Extractor>* {
+  auto ptr = getComponentStorage<T>();
+
+  if (!ptr)
+    ptr = createComponentStorage<T>();
+
+  return ptr ? ptr->addIndex(std::make_unique<ComponentHashIndex<T, Extractor>>(
+      std::forward<Extractor>(extractor))) : nullptr;
+}
+
+template <typename Traits>
+template <typename T, typename Extractor>
+auto BasicRegistry<Traits>::createOrderedIndex(Extractor&& extractor)
+    -> ComponentOrderedIndex<T, Extractor>* {
+  auto ptr = getComponentStorage<T>();
+
+  if (!ptr)
+    ptr = createComponentStorage<T>();
+
+  return ptr ? ptr->addIndex(std::make_unique<ComponentOrderedIndex<T, Extractor>>(
+      std::forward<Extractor>(extractor))) : nullptr;
+}
+
+template <typename Traits>
 template <typename T>
-T* Registry::getComponent(Entity entity) {
+T* BasicRegistry<Traits>::getComponent(Entity entity) {
   auto ptr = getComponentStorage<T>();
   return ptr ? ptr->get(entity) : nullptr;
 }
 
+template <typename Traits>
 template <typename T>
-void Registry::setComponent(Entity entity, const T& data) {
+void BasicRegistry<Traits>::getComponents(const Entity* entities, size_t count,
+                                          T** out) {
+  auto ptr = getComponentStorage<T>();
+
+  if (ptr)
+    ptr->getBatch(entities, count, out);
+  else
+    std::fill(out, out + count, nullptr);
+}
+
+template <typename Traits>
+template <typename T>
+void BasicRegistry<Traits>::getComponents(const std::vector<Entity>& entities,
+                                          std::vector<T*>& out) {
+  out.resize(entities.size());
+  getComponents<T>(entities.data(), entities.size(), out.data());
+}
+
+template <typename Traits>
+template <typename T>
+void BasicRegistry<Traits>::setComponent(Entity entity, const T& data) {
   auto ptr = getComponentStorage<T>();
 
   if (!ptr)
@@ -210,8 +698,9 @@ void Registry::setComponent(Entity entity, const T& data) {
     ptr->set(entity, data);
 }
 
+template <typename Traits>
 template <typename T>
-void Registry::setComponent(Entity entity, T&& data) {
+void BasicRegistry<Traits>::setComponent(Entity entity, T&& data) {
   auto ptr = getComponentStorage<T>();
 
   if (!ptr)
@@ -221,8 +710,9 @@ void Registry::setComponent(Entity entity, T&& data) {
     ptr->set(entity, data);
 }
 
+template <typename Traits>
 template <typename T>
-void Registry::addComponent(Entity entity) {
+void BasicRegistry<Traits>::addComponent(Entity entity) {
   auto ptr = getComponentStorage<T>();
 
   if (!ptr)
@@ -232,8 +722,9 @@ void Registry::addComponent(Entity entity) {
     ptr->add(entity, {});
 }
 
+template <typename Traits>
 template <typename T>
-void Registry::addComponent(Entity entity, const T& data) {
+void BasicRegistry<Traits>::addComponent(Entity entity, const T& data) {
   auto ptr = getComponentStorage<T>();
 
   if (!ptr)
@@ -243,8 +734,9 @@ void Registry::addComponent(Entity entity, const T& data) {
     ptr->add(entity, data);
 }
 
+template <typename Traits>
 template <typename T>
-void Registry::addComponent(Entity entity, T&& data) {
+void BasicRegistry<Traits>::addComponent(Entity entity, T&& data) {
   auto ptr = getComponentStorage<T>();
 
   if (!ptr)
@@ -254,65 +746,269 @@ void Registry::addComponent(Entity entity, T&& data) {
     ptr->add(entity, std::move(data));
 }
 
+template <typename Traits>
 template <typename T>
-void Registry::removeComponent(Entity entity) {
+void BasicRegistry<Traits>::removeComponent(Entity entity) {
   auto ptr = getComponentStorage<T>();
   if (ptr)
     ptr->remove(entity);
 }
 
 
+template <typename Traits>
+template <typename R, typename... Args>
+R* BasicRegistry<Traits>::emplaceResource(Args&&... args) {
+  auto index = uniqueIndex<R>().get();
+
+  if (index >= resources_.size())
+    resources_.resize(index + 1);
+
+  resources_[index] = std::make_shared<R>(std::forward<Args>(args)...);
+  return static_cast<R*>(resources_[index].get());
+}
+
+template <typename Traits>
+template <typename R>
+R* BasicRegistry<Traits>::getResource() {
+  auto index = uniqueIndex<R>().get();
+  return index < resources_.size() ?
+      static_cast<R*>(resources_[index].get()) : nullptr;
+}
+
+template <typename Traits>
+template <typename R>
+void BasicRegistry<Traits>::removeResource() {
+  auto index = uniqueIndex<R>().get();
+  if (index < resources_.size())
+    resources_[index].reset();
+}
+
+template <typename Traits>
+template <typename T>
+void BasicRegistry<Traits>::clearComponents() {
+  auto ptr = getComponentStorage<T>();
+  if (ptr)
+    ptr->clear();
+}
+
+template <typename Traits>
 template <typename T>
-void Registry::componentList(std::vector<Component>& list) {
+void BasicRegistry<Traits>::swapComponentBuffers(bool carryOver) {
+  auto ptr = getComponentStorage<T>();
+  if (ptr)
+    ptr->container().swapBuffers(carryOver);
+}
+
+template <typename Traits>
+template <typename T>
+const T* BasicRegistry<Traits>::getPublishedComponent(Entity entity) {
+  auto ptr = getComponentStorage<T>();
+  if (!ptr || !ptr->contains(entity))
+    return nullptr;
+
+  auto dPos = ptr->densePosFromKey(entity);
+  return ptr->container().isPublished(dPos) ?
+      &ptr->container().published(dPos) : nullptr;
+}
+
+template <typename Traits>
+template <typename T>
+void BasicRegistry<Traits>::setParent(Entity entity, Entity parent) {
+  auto ptr = getHierarchyStorage<T>();
+  if (ptr)
+    ptr->reparent(entity, parent);
+}
+
+template <typename Traits>
+template <typename T>
+auto BasicRegistry<Traits>::getParent(Entity entity) -> Entity {
+  auto ptr = getHierarchyStorage<T>();
+  return ptr ? ptr->parentOf(entity) : NullEntity;
+}
+
+template <typename Traits>
+template <typename T>
+void BasicRegistry<Traits>::registerEntityReference(Entity T::* member) {
+  auto ptr = getComponentStorage<T>();
+
+  if (!ptr)
+    ptr = createComponentStorage<T>();
+
+  if (ptr)
+    ptr->addReference(member);
+}
+
+template <typename Traits>
+auto BasicRegistry<Traits>::merge(BasicRegistry&& src) -> EntityRemap {
+  PEBBLE_TRACE_SCOPE("Registry::merge");
+
+  EntityRemap remap;
+
+  if (!compatibleStorages(src)) {
+    assert(false && "Cannot merge registries, storage types differ!");
+    return remap;
+  }
+
+  auto count = src.entityCount_.load(std::memory_order_relaxed);
+
+  for (EntityID id = 0; id < count; ++id) {
+    auto e = src.entities_[id].load(std::memory_order_relaxed);
+    if (entityIdentifier(e) == id)
+      remap.set(e, createEntity());
+  }
+
+  size_t dPos = 0;
+  std::for_each(src.components_.keyBegin(), src.components_.keyEnd(),
+    [&](Component index)
+  {
+    if (src.components_.validAt(dPos++))
+      src.components_.get(index)->mergeInto(*adoptStorage(src, index), remap);
+  });
+
+  src.resetRegistry();
+
+  return remap;
+}
+
+template <typename Traits>
+bool BasicRegistry<Traits>::compatibleStorages(BasicRegistry& src) {
+  bool compatible = true;
+  size_t dPos = 0;
+
+  std::for_each(src.components_.keyBegin(), src.components_.keyEnd(),
+    [&](Component index)
+  {
+    if (!src.components_.validAt(dPos++))
+      return;
+
+    auto from = src.components_.get(index);
+    auto to = components_.get(index);
+    if (to && typeid(*to) != typeid(*from))
+      compatible = false;
+  });
+
+  return compatible;
+}
+
+template <typename Traits>
+auto BasicRegistry<Traits>::adoptStorage(BasicRegistry& src, Component index)
+    -> BaseStorageSet<Entity, generationBitCount>* {
+  auto to = components_.get(index);
+
+  if (!to) {
+    components_.add(index, src.components_.get(index)->createEmpty());
+    to = components_.get(index);
+
+    if (std::find(src.transientComponents_.begin(),
+                  src.transientComponents_.end(), index) !=
+        src.transientComponents_.end())
+      transientComponents_.push_back(index);
+  }
+
+  return to;
+}
+
+template <typename Traits>
+auto BasicRegistry<Traits>::migrate(const std::vector<Entity>& entities,
+    BasicRegistry& dst) -> EntityRemap {
+  PEBBLE_TRACE_SCOPE("Registry::migrate");
+
+  EntityRemap remap;
+  std::vector<Entity> moved;
+
+  if (!dst.compatibleStorages(*this)) {
+    assert(false && "Cannot migrate entities, storage types differ!");
+    return remap;
+  }
+
+  std::for_each(entities.begin(), entities.end(), [&](Entity entity) {
+    auto id = entityIdentifier(entity);
+    if (id < entities_.size() &&
+        entity == entities_[id].load(std::memory_order_relaxed) &&
+        remap(entity) == NullEntity) {
+      remap.set(entity, dst.createEntity());
+      moved.push_back(entity);
+    }
+  });
+
+  size_t dPos = 0;
+  std::for_each(components_.keyBegin(), components_.keyEnd(),
+    [&](Component index)
+  {
+    if (components_.validAt(dPos++)) {
+      components_.get(index)->migrateTo(*dst.adoptStorage(*this, index),
+          moved.data(), moved.size(), remap);
+    }
+  });
+
+  std::for_each(moved.begin(), moved.end(), [this](Entity entity) {
+    deleteEntity(entity);
+  });
+
+  return remap;
+}
+
+
+template <typename Traits>
+template <typename T>
+void BasicRegistry<Traits>::componentList(std::vector<Component>& list) {
   list.push_back(uniqueIndex<T>());
 }
 
+template <typename Traits>
 template <typename T, typename... Ts>
 std::enable_if_t<(sizeof...(Ts) >= 1), void>
-Registry::componentList(std::vector<Component>& list) {
+BasicRegistry<Traits>::componentList(std::vector<Component>& list) {
   list.push_back(uniqueIndex<T>());
   componentList<Ts...>(list);
 }
 
+template <typename Traits>
 template <typename T, typename... Ts>
-std::vector<Component> Registry::componentList() {
+std::vector<Component> BasicRegistry<Traits>::componentList() {
   std::vector<Component> list;
   componentList<T, Ts...>(list);
   return list;
 }
 
+template <typename Traits>
 template <typename T>
-void Registry::getEntities(Component index, std::vector<Entity>& list) {
+void BasicRegistry<Traits>::getEntities(Component index, std::vector<Entity>& list) {
   if (uniqueIndex<T>() == index) {
     auto ptr = components_.get(index);
     if (ptr) {
-      std::for_each(ptr->keyBegin(), ptr->keyEnd(), [&list, ptr](auto& e) {
-        if (ptr->contains(e))
+      size_t dPos = 0;
+      std::for_each(ptr->keyBegin(), ptr->keyEnd(), [&](auto& e) {
+        if (ptr->validAt(dPos++))
           list.push_back(e);
       });
     }
   }
 }
 
+template <typename Traits>
 template <typename T, typename... Ts>
 std::enable_if_t<(sizeof...(Ts) > 0), void>
-Registry::getEntities(Component index, std::vector<Entity>& list) {
+BasicRegistry<Traits>::getEntities(Component index, std::vector<Entity>& list) {
   if (uniqueIndex<T>() == index)
     getEntities<T>(index, list);
   else
     getEntities<Ts...>(index, list);
 }
 
+template <typename Traits>
 template <typename T, typename... Ts>
-std::vector<Entity> Registry::getEntities(Component index) {
+auto BasicRegistry<Traits>::getEntities(Component index)
+    -> std::vector<Entity> {
   std::vector<Entity> list;
   getEntities<T, Ts...>(index, list);
 
   return list;
 }
 
+template <typename Traits>
 template <typename T>
-void Registry::removeUncommonEntities(std::vector<Entity>& list) {
+void BasicRegistry<Traits>::removeUncommonEntities(std::vector<Entity>& list) {
   std::vector<Entity> common;
   auto ptr = getComponentStorage<T>();
 
@@ -326,22 +1022,23 @@ void Registry::removeUncommonEntities(std::vector<Entity>& list) {
   list = common;
 }
 
+template <typename Traits>
 template <typename T, typename... Ts>
 std::enable_if_t<(sizeof...(Ts) > 0), void>
-Registry::removeUncommonEntities(std::vector<Entity>& list) {
+BasicRegistry<Traits>::removeUncommonEntities(std::vector<Entity>& list) {
   removeUncommonEntities<T>(list);
   removeUncommonEntities<Ts...>(list);
 }
 
+template <typename Traits>
 template <typename T>
-uint32_t Registry::count() {
+uint32_t BasicRegistry<Traits>::count() {
   uint32_t counter = 0;
   auto ptr = getComponentStorage<T>();
   if (ptr) {
     size_t idx = 0;
     std::for_each(ptr->begin(), ptr->end(), [&](auto& value){
-      Entity e = *(ptr->keyBegin() + idx++);
-      if (ptr->contains(e))
+      if (ptr->validAt(idx++))
         ++counter;
     });
   }
@@ -349,8 +1046,9 @@ uint32_t Registry::count() {
   return counter;
 }
 
+template <typename Traits>
 template <typename... Ts>
-std::enable_if_t<(sizeof...(Ts) > 1), uint32_t> Registry::count() {
+std::enable_if_t<(sizeof...(Ts) > 1), uint32_t> BasicRegistry<Traits>::count() {
   auto keyList = componentList<Ts...>();
   auto shortest = shortestComponent(keyList);
   uint32_t counter = 0;
@@ -367,27 +1065,35 @@ std::enable_if_t<(sizeof...(Ts) > 1), uint32_t> Registry::count() {
   return counter;
 }
 
+template <typename Traits>
 template <typename T, typename Functor>
-void Registry::forEach(Functor&& f) {
+void BasicRegistry<Traits>::forEach(Functor&& f) {
+  PEBBLE_TRACE_SCOPE("Registry::forEach");
+
   auto ptr = getComponentStorage<T>();
   if (ptr) {
+    PEBBLE_TRACE_ADD(EntitiesVisited, ptr->validCount());
+
     size_t idx = 0;
     std::for_each(ptr->begin(), ptr->end(), [&](auto& value){
-      Entity e = *(ptr->keyBegin() + idx++);
-      if (ptr->contains(e))
+      if (ptr->validAt(idx++))
         f(value);
     });
   }
 }
 
+template <typename Traits>
 template <typename... Ts, typename Functor>
-std::enable_if_t<(sizeof...(Ts) > 1), void> Registry::forEach(Functor&& f) {
+std::enable_if_t<(sizeof...(Ts) > 1), void> BasicRegistry<Traits>::forEach(Functor&& f) {
+  PEBBLE_TRACE_SCOPE("Registry::forEach");
+
   auto keyList = componentList<Ts...>();
   auto shortest = shortestComponent(keyList);
 
   if (shortest.second > 0 && shortest.second != maxValue<size_t>()) {
     auto entityList = getEntities<Ts...>(shortest.first);
     removeUncommonEntities<Ts...>(entityList);
+    PEBBLE_TRACE_ADD(EntitiesVisited, entityList.size());
 
     std::for_each(entityList.begin(), entityList.end(), [&](Entity& e){
             auto params = std::tuple<Ts&...>(*getComponent<Ts>(e)...);
@@ -396,29 +1102,38 @@ std::enable_if_t<(sizeof...(Ts) > 1), void> Registry::forEach(Functor&& f) {
   }
 }
 
+template <typename Traits>
 template <typename T, typename Functor>
-void Registry::forEachWithEntity(Functor&& f)
+void BasicRegistry<Traits>::forEachWithEntity(Functor&& f)
 {
+  PEBBLE_TRACE_SCOPE("Registry::forEachWithEntity");
+
   auto ptr = getComponentStorage<T>();
   if (ptr) {
+    PEBBLE_TRACE_ADD(EntitiesVisited, ptr->validCount());
+
     size_t idx = 0;
     std::for_each(ptr->begin(), ptr->end(), [&](auto& value) {
-      Entity e = *(ptr->keyBegin() + idx++);
-      if (ptr->contains(e))
+      Entity e = *(ptr->keyBegin() + idx);
+      if (ptr->validAt(idx++))
         f(e, value);
     });
   }
 }
 
+template <typename Traits>
 template <typename... Ts, typename Functor>
-std::enable_if_t<(sizeof...(Ts) > 1), void> Registry::forEachWithEntity(Functor&& f)
+std::enable_if_t<(sizeof...(Ts) > 1), void> BasicRegistry<Traits>::forEachWithEntity(Functor&& f)
 {
+  PEBBLE_TRACE_SCOPE("Registry::forEachWithEntity");
+
   auto keyList = componentList<Ts...>();
   auto shortest = shortestComponent(keyList);
   
   if (shortest.second > 0 && shortest.second != maxValue<size_t>()) {
     auto entityList = getEntities<Ts...>(shortest.first);
     removeUncommonEntities<Ts...>(entityList);
+    PEBBLE_TRACE_ADD(EntitiesVisited, entityList.size());
     
     std::for_each(entityList.begin(), entityList.end(), [&](Entity& e) {
       auto params = std::tuple<Entity, Ts&...>(e, *getComponent<Ts>(e)...);
@@ -427,4 +1142,150 @@ std::enable_if_t<(sizeof...(Ts) > 1), void> Registry::forEachWithEntity(Functor&
   }
 }
 
+template <typename Traits>
+template <typename... Ts, typename... Rs, typename Functor>
+void BasicRegistry<Traits>::forEach(Resources<Rs...>, Functor&& f) {
+  assert((getResource<Rs>() && ...) && "Cannot find resource!");
+  auto resources = std::tuple<Rs&...>(*getResource<Rs>()...);
+
+  forEach<Ts...>([&](auto&... components) {
+    std::apply([&](auto&... rs) { f(rs..., components...); }, resources);
+  });
+}
+
+template <typename Traits>
+template <typename... Ts, typename... Rs, typename Functor>
+void BasicRegistry<Traits>::forEachWithEntity(Resources<Rs...>, Functor&& f) {
+  assert((getResource<Rs>() && ...) && "Cannot find resource!");
+  auto resources = std::tuple<Rs&...>(*getResource<Rs>()...);
+
+  forEachWithEntity<Ts...>([&](Entity e, auto&... components) {
+    std::apply([&](auto&... rs) { f(e, rs..., components...); }, resources);
+  });
+}
+
+template <typename Traits>
+template <typename T, typename Functor>
+void BasicRegistry<Traits>::forEachPublished(Functor&& f) {
+  auto ptr = getComponentStorage<T>();
+  if (ptr) {
+    size_t idx = 0;
+    std::for_each(ptr->container().publishedBegin(),
+                  ptr->container().publishedEnd(), [&](const T& value) {
+      Entity e = *(ptr->keyBegin() + idx);
+      if (ptr->validAt(idx) && ptr->container().isPublished(idx))
+        f(e, value);
+      ++idx;
+    });
+  }
+}
+
+template <typename Traits>
+template <typename T, typename Functor>
+void BasicRegistry<Traits>::forEachWithParent(Functor&& f) {
+  PEBBLE_TRACE_SCOPE("Registry::forEachWithParent");
+
+  auto ptr = getHierarchyStorage<T>();
+  if (ptr)
+    ptr->forEachWithParent(std::forward<Functor>(f));
+}
+
+template <typename Traits>
+template <typename T, typename... Ts, typename Functor>
+bool BasicRegistry<Traits>::forEachBudgeted(IterationCursor& cursor,
+    const IterationBudget& budget, Functor&& f) {
+  return budgetedPass<false, T, Ts...>(cursor, budget, f);
+}
+
+template <typename Traits>
+template <typename T, typename... Ts, typename Functor>
+bool BasicRegistry<Traits>::forEachWithEntityBudgeted(IterationCursor& cursor,
+    const IterationBudget& budget, Functor&& f) {
+  return budgetedPass<true, T, Ts...>(cursor, budget, f);
+}
+
+template <typename Traits>
+template <bool withEntity, typename T, typename... Ts, typename Functor>
+bool BasicRegistry<Traits>::budgetedPass(IterationCursor& cursor,
+    const IterationBudget& budget, Functor& f) {
+  PEBBLE_TRACE_SCOPE("Registry::forEachBudgeted");
+
+  auto ptr = getComponentStorage<T>();
+  auto others = std::make_tuple(getComponentStorage<Ts>()...);
+
+  if (!ptr || !(std::get<ComponentStorageSet<Ts>*>(others) && ...)) {
+    cursor.position = 0;
+    return true;
+  }
+
+  // the set may have shrunk since the last call
+  auto dPos = std::min(cursor.position, size_t(ptr->totalCount()));
+  auto start = std::chrono::steady_clock::now();
+  auto clockInterval = std::max(budget.clockInterval, size_t(1));
+  size_t visited = 0;
+  size_t scanned = 0;
+
+  for (; dPos < ptr->totalCount(); ++dPos, ++scanned) {
+    if (visited >= budget.maxEntities)
+      break;
+
+    // counts scanned slots so sparse matches cannot outrun the clock
+    if (scanned > 0 && scanned % clockInterval == 0 &&
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start) >= budget.maxTime)
+      break;
+
+    Entity e = *(ptr->keyBegin() + dPos);
+    if (!ptr->validAt(dPos) ||
+        !(std::get<ComponentStorageSet<Ts>*>(others)->contains(e) && ...))
+      continue;
+
+    ++visited;
+
+    if constexpr (withEntity)
+      f(e, *ptr->getAt(dPos),
+        *std::get<ComponentStorageSet<Ts>*>(others)->get(e)...);
+    else
+      f(*ptr->getAt(dPos),
+        *std::get<ComponentStorageSet<Ts>*>(others)->get(e)...);
+  }
+
+  PEBBLE_TRACE_ADD(EntitiesVisited, visited);
+
+  cursor.position = dPos < ptr->totalCount() ? dPos : 0;
+  return dPos >= ptr->totalCount();
+}
+
+extern template class BasicRegistry<DefaultEntityTraits>;
+
+using Registry = BasicRegistry<DefaultEntityTraits>;
+
+using Entity           = Registry::Entity;
+using EntityID         = Registry::EntityID;
+using EntityGeneration = Registry::EntityGeneration;
+using EntityBlock      = Registry::EntityBlock;
+
+constexpr size_t generationBitCount = Registry::generationBitCount;
+constexpr size_t identifierBitCount = Registry::identifierBitCount;
+
+static constexpr EntityID entityIdentifier(Entity entity) {
+  return Registry::entityIdentifier(entity);
+}
+
+static constexpr EntityGeneration entityGeneration(Entity entity) {
+  return Registry::entityGeneration(entity);
+}
+
+static constexpr Entity entityCombine(EntityID id, EntityGeneration gen) {
+  return Registry::entityCombine(id, gen);
+}
+
+static constexpr Entity NullEntity = Registry::NullEntity;
+
+template <typename T>
+using ComponentStorageSet = Registry::ComponentStorageSet<T>;
+
+template <typename T>
+using ComponentHierarchySet = Registry::ComponentHierarchySet<T>;
+
 }
@@ -0,0 +1,124 @@
+//
+//  StorageIndex.hpp
+//  PebbleEngine
+//
+
+#pragma once
+
+#include "../Core/PebbleCom.hpp"
+#include "BaseStorageSet.hpp"
+
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+
+namespace pebble {
+
+template <typename Key, typename Type>
+class BaseStorageIndex {
+public:
+  virtual ~BaseStorageIndex() = default;
+
+  virtual void insert(Key key, const Type& value) = 0;
+  virtual void erase(Key key) = 0;
+  virtual void clear() = 0;
+};
+
+template <typename Type, typename Extractor>
+using index_key_t = std::decay_t<std::invoke_result_t<Extractor, const Type&>>;
+
+// Secondary index from a value extracted from Type back to the set of keys
+// holding it, so updating one key costs O(1) (hash) or O(log n) (ordered)
+// whatever the number of keys sharing its value. Kept up to date by
+// StorageSet add/set/remove. The value each key was indexed under is stored,
+// so a component modified in place through get() or forEach keeps its old
+// entry until it is set() again, and remove always drops the key.
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Extractor, typename Map>
+class StorageIndex : public BaseStorageIndex<Key, Type> {
+public:
+  using IndexKey = index_key_t<Type, Extractor>;
+
+  static constexpr Key NullKey =
+      static_cast<Key>(BaseKeyInfo<Key, keyPrefixBitCount>::NullKey);
+
+  StorageIndex(Extractor extractor) : extractor_(std::move(extractor)) {}
+
+  virtual ~StorageIndex() = default;
+
+  virtual void insert(Key key, const Type& value) override {
+    auto indexKey = extractor_(value);
+    map_[indexKey].insert(key);
+    indexed_.insert_or_assign(key, std::move(indexKey));
+  }
+
+  virtual void erase(Key key) override {
+    auto indexed = indexed_.find(key);
+    if (indexed == indexed_.end())
+      return;
+
+    auto it = map_.find(indexed->second);
+    if (it != map_.end()) {
+      it->second.erase(key);
+      if (it->second.empty())
+        map_.erase(it);
+    }
+
+    indexed_.erase(indexed);
+  }
+
+  virtual void clear() override {
+    map_.clear();
+    indexed_.clear();
+  }
+
+  // returns a key holding value, NullKey if there is none
+  Key find(const IndexKey& value) {
+    auto it = map_.find(value);
+    return it != map_.end() ? *it->second.begin() : NullKey;
+  }
+
+  size_t count(const IndexKey& value) {
+    auto it = map_.find(value);
+    return it != map_.end() ? it->second.size() : 0;
+  }
+
+  template <typename Functor>
+  void forEachMatch(const IndexKey& value, Functor&& f) {
+    auto it = map_.find(value);
+    if (it != map_.end())
+      std::for_each(it->second.begin(), it->second.end(), f);
+  }
+
+  // keys whose value lies in [low, high) in value order (keys sharing a value
+  // come in no particular order), ordered indexes only
+  template <typename Functor>
+  void forEachInRange(const IndexKey& low, const IndexKey& high, Functor&& f) {
+    std::for_each(map_.lower_bound(low), map_.lower_bound(high),
+      [&f](auto& pair)
+    {
+      std::for_each(pair.second.begin(), pair.second.end(), f);
+    });
+  }
+
+private:
+  Extractor extractor_;
+  Map       map_;
+
+  // value each key is currently filed under, independent of later in-place
+  // changes to the component
+  std::unordered_map<Key, IndexKey> indexed_;
+};
+
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Extractor>
+using HashStorageIndex = StorageIndex<Key, keyPrefixBitCount, Type, Extractor,
+    std::unordered_map<index_key_t<Type, Extractor>, std::unordered_set<Key>>>;
+
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Extractor>
+using OrderedStorageIndex = StorageIndex<Key, keyPrefixBitCount, Type, Extractor,
+    std::map<index_key_t<Type, Extractor>, std::unordered_set<Key>>>;
+
+}
@@ -9,12 +9,56 @@
 
 #include "../Core/PebbleCom.hpp"
 #include "BaseStorageSet.hpp"
+#include "StorageIndex.hpp"
 
 
 namespace pebble {
 
-template <typename Key, size_t keyPrefixBitCount, typename Type>
+// Type itself, or what it points to for smart pointers
+template <typename T, typename = void>
+struct element_type_of {
+  using type = T;
+};
+
+template <typename T>
+struct element_type_of<T, std::enable_if_t<is_smart_ptr<T>::value>> {
+  using type = typename T::element_type;
+};
+
+// containers keeping per-slot state provide claim(pos), called whenever a
+// recycled dense slot is handed to a new key
+template <typename Storage, typename = void>
+struct has_slot_claim : std::false_type {};
+
+template <typename Storage>
+struct has_slot_claim<Storage,
+    std::void_t<decltype(std::declval<Storage&>().claim(size_t()))>>
+    : std::true_type {};
+
+// containers keeping per-slot state provide transfer(pos, from, fromPos),
+// used to move a slot between sets on merge/migrate
+template <typename Storage, typename = void>
+struct has_slot_transfer : std::false_type {};
+
+template <typename Storage>
+struct has_slot_transfer<Storage,
+    std::void_t<decltype(std::declval<Storage&>().transfer(
+        size_t(), std::declval<Storage&>(), size_t()))>>
+    : std::true_type {};
+
+// owner of entity reference members for non-class component types
+struct NoReferences {};
+
+// Storage is the container holding the components in dense order. It must
+// provide size(), operator[], push_back(), clear() and begin()/end() with
+// std::vector semantics, but may keep its elements wherever it likes.
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
 class StorageSet : public BaseStorageSet<Key, keyPrefixBitCount> {
+  using Element = typename element_type_of<Type>::type;
+  using ReferenceOwner =
+      std::conditional_t<std::is_class_v<Element>, Element, NoReferences>;
+
 public:
   StorageSet(size_t pageSize = defaultPageSize,
              size_t pageCountMax  = defaultPageCountMax)
@@ -30,8 +74,43 @@ public:
 
   virtual void clear() override {
     storage_.clear();
+
+    for (auto& index : indexes_)
+      index->clear();
+
+    BaseStorageSet<Key, keyPrefixBitCount>::clear();
+  }
+
+  virtual void remove(Key key) override {
+    if (this->contains(key))
+      indexErase(key);
+
+    BaseStorageSet<Key, keyPrefixBitCount>::remove(key);
   }
 
+  virtual BaseStorageSet<Key, keyPrefixBitCount>* createEmpty() override {
+    auto ptr = new StorageSet(this->pageSize_, this->pageCountMax_);
+    ptr->references_ = references_;
+    return ptr;
+  }
+
+  virtual void mergeInto(BaseStorageSet<Key, keyPrefixBitCount>& dst,
+      const KeyRemap<Key, keyPrefixBitCount>& remap) override;
+
+  virtual void migrateTo(BaseStorageSet<Key, keyPrefixBitCount>& dst,
+      const Key* keys, size_t count,
+      const KeyRemap<Key, keyPrefixBitCount>& remap) override;
+
+  // key member rewritten through the remap whenever elements are moved to
+  // another set by mergeInto()/migrateTo()
+  void addReference(Key ReferenceOwner::* member) {
+    references_.push_back(member);
+  }
+
+  // takes ownership of index and fills it from the current contents
+  template <typename Index>
+  Index* addIndex(std::unique_ptr<Index> index);
+
   // returns Type* to element in storage (deref from smart ptr)
   template <typename T = Type>
   typename std::enable_if_t<is_smart_ptr<T>::value, typename std::add_pointer_t<
@@ -44,6 +123,23 @@ public:
   typename std::add_pointer_t<T>>
   get(Key key);
 
+  // returns Type* to element at dense position dPos (deref from smart ptr),
+  // the caller checks that the key stored there is still valid
+  template <typename T = Type>
+  typename std::enable_if_t<is_smart_ptr<T>::value, typename std::add_pointer_t<
+  typename std::remove_reference_t<T>::element_type>>
+  getAt(size_t dPos);
+
+  // returns Type* to element at dense position dPos
+  template <typename T = Type>
+  typename std::enable_if_t<!is_smart_ptr<T>::value,
+  typename std::add_pointer_t<T>>
+  getAt(size_t dPos);
+
+  // out[i] = get(keys[i])
+  template <typename Pointer>
+  void getBatch(const Key* keys, size_t count, Pointer* out);
+
   template <typename T = Type>
   void set(Key key, typename std::enable_if_t<is_smart_ptr<T>::value,
            typename std::add_pointer_t<
@@ -76,7 +172,50 @@ public:
 private:
   size_t add(Key key);
 
+protected:
+  // drops a key whose element has already been moved out
+  virtual void dropMoved(Key key) {
+    BaseStorageSet<Key, keyPrefixBitCount>::remove(key);
+  }
+
+  // moves from[fromPos] into dense position dPos, dPos == size() appends;
+  // containers with per-slot state carry it over through transfer()
+  void moveSlot(size_t dPos, Storage& from, size_t fromPos) {
+    if constexpr (has_slot_transfer<Storage>::value)
+      storage_.transfer(dPos, from, fromPos);
+    else if (dPos == storage_.size())
+      storage_.push_back(std::move(from[fromPos]));
+    else
+      storage_[dPos] = std::move(from[fromPos]);
+  }
+
+  void remapReferences(size_t dPos,
+                       const KeyRemap<Key, keyPrefixBitCount>& remap,
+                       const StorageSet& origin) {
+    if constexpr (std::is_class_v<Element>) {
+      auto ptr = getAt(dPos);
+      if (ptr) {
+        for (auto member : origin.references_)
+          ptr->*member = remap(ptr->*member);
+      }
+    }
+  }
+
+  void indexInsert(Key key, size_t dPos) {
+    for (auto& index : indexes_)
+      index->insert(key, storage_[dPos]);
+  }
+
+  void indexErase(Key key) {
+    for (auto& index : indexes_)
+      index->erase(key);
+  }
+
 public:
+  // the underlying container, for policy-specific operations
+  Storage&       container()       { return storage_; }
+  const Storage& container() const { return storage_; }
+
   auto begin()  { return storage_.begin();  }
   auto cbegin() { return storage_.cbegin(); }
   auto end()    { return storage_.end();    }
@@ -84,63 +223,110 @@ public:
 
 private:
   const std::type_info& (*storageType_)();
-  std::vector<Type> storage_;
+
+protected:
+  Storage storage_;
+  std::vector<std::unique_ptr<BaseStorageIndex<Key, Type>>> indexes_;
+  std::vector<Key ReferenceOwner::*> references_;
 };
 
 
 // returns const Type& reference to element in storage (deref from smart ptr)
-template <typename Key, size_t keyPrefixBitCount, typename Type>
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
 template <typename T>
 typename std::enable_if_t<is_smart_ptr<T>::value,
 typename std::add_pointer_t<
 typename std::remove_reference_t<T>::element_type>>
-StorageSet<Key, keyPrefixBitCount, Type>::
+StorageSet<Key, keyPrefixBitCount, Type, Storage>::
 get(Key key) {
   return this->contains(key) ?
       storage_[this->densePosFromKey(key)].get() : nullptr;
 }
 
 // returns const Type& reference to element in storage
-template <typename Key, size_t keyPrefixBitCount, typename Type>
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
 template <typename T>
 typename std::enable_if_t<!is_smart_ptr<T>::value,
 typename std::add_pointer_t<T>>
-StorageSet<Key, keyPrefixBitCount, Type>::
+StorageSet<Key, keyPrefixBitCount, Type, Storage>::
 get(Key key) {
   return this->contains(key) ? &storage_[this->densePosFromKey(key)] : nullptr;
 }
 
-template <typename Key, size_t keyPrefixBitCount, typename Type>
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
 template <typename T>
-void StorageSet<Key, keyPrefixBitCount, Type>::
+typename std::enable_if_t<is_smart_ptr<T>::value,
+typename std::add_pointer_t<
+typename std::remove_reference_t<T>::element_type>>
+StorageSet<Key, keyPrefixBitCount, Type, Storage>::
+getAt(size_t dPos) {
+  return storage_[dPos].get();
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
+template <typename T>
+typename std::enable_if_t<!is_smart_ptr<T>::value,
+typename std::add_pointer_t<T>>
+StorageSet<Key, keyPrefixBitCount, Type, Storage>::
+getAt(size_t dPos) {
+  return &storage_[dPos];
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
+template <typename Pointer>
+void StorageSet<Key, keyPrefixBitCount, Type, Storage>::
+getBatch(const Key* keys, size_t count, Pointer* out) {
+  for (size_t i = 0; i < count; ++i)
+    out[i] = get(keys[i]);
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
+template <typename T>
+void StorageSet<Key, keyPrefixBitCount, Type, Storage>::
 set(Key key,
     typename std::enable_if_t<is_smart_ptr<T>::value,
         typename std::add_pointer_t<
         typename std::remove_reference_t<T>::element_type>> data) {
 
-  if (contains(key))
-    storage_[densePosFromKey(key)] = T(data);
+  if (this->contains(key)) {
+    auto dPos = this->densePosFromKey(key);
+    indexErase(key);
+    storage_[dPos] = T(data);
+    indexInsert(key, dPos);
+  }
   else
     add(key, data);
 }
 
-template <typename Key, size_t keyPrefixBitCount, typename Type>
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
 template <typename T>
-void StorageSet<Key, keyPrefixBitCount, Type>::
+void StorageSet<Key, keyPrefixBitCount, Type, Storage>::
 set(Key key,
     typename std::enable_if_t<!is_smart_ptr<T>::value,
         typename std::add_lvalue_reference_t<typename std::add_const_t<
         typename std::remove_reference_t<T>>>> data) {
 
-  if (this->contains(key))
-    storage_[this->densePosFromKey(key)] = data;
+  if (this->contains(key)) {
+    auto dPos = this->densePosFromKey(key);
+    indexErase(key);
+    storage_[dPos] = data;
+    indexInsert(key, dPos);
+  }
   else
     add(key, data);
 }
 
-template <typename Key, size_t keyPrefixBitCount, typename Type>
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
 template <typename T>
-void StorageSet<Key, keyPrefixBitCount, Type>::
+void StorageSet<Key, keyPrefixBitCount, Type, Storage>::
 add(Key key,
     typename std::enable_if_t<is_smart_ptr<T>::value,
         typename std::add_pointer_t<
@@ -156,12 +342,15 @@ add(Key key,
       storage_.push_back(T(data));
     else
       storage_[pos] = T(data);
+
+    indexInsert(key, pos);
   }
 }
 
-template <typename Key, size_t keyPrefixBitCount, typename Type>
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
 template <typename T>
-void StorageSet<Key, keyPrefixBitCount, Type>::
+void StorageSet<Key, keyPrefixBitCount, Type, Storage>::
 add(Key key,
     typename std::enable_if_t<!is_smart_ptr<T>::value,
         typename std::add_lvalue_reference_t<typename std::add_const_t<
@@ -177,12 +366,15 @@ add(Key key,
       storage_.push_back(data);
     else
       storage_[pos] = data;
+
+    indexInsert(key, pos);
   }
 }
 
-template <typename Key, size_t keyPrefixBitCount, typename Type>
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
 template <typename T>
-void StorageSet<Key, keyPrefixBitCount, Type>::
+void StorageSet<Key, keyPrefixBitCount, Type, Storage>::
 add(Key key,
     typename std::enable_if_t<!is_smart_ptr<T>::value,
         typename std::add_rvalue_reference_t<
@@ -198,11 +390,109 @@ add(Key key,
       storage_.push_back(std::move(data));
     else
       storage_[pos] = std::move(data);
+
+    indexInsert(key, pos);
   }
 }
 
-template <typename Key, size_t keyPrefixBitCount, typename Type>
-size_t StorageSet<Key, keyPrefixBitCount, Type>::
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
+template <typename Index>
+Index* StorageSet<Key, keyPrefixBitCount, Type, Storage>::
+addIndex(std::unique_ptr<Index> index) {
+  for (size_t dPos = 0; dPos < this->dense_.size(); ++dPos) {
+    if (this->validAt(dPos))
+      index->insert(this->dense_[dPos], storage_[dPos]);
+  }
+
+  auto ptr = index.get();
+  indexes_.push_back(std::move(index));
+
+  return ptr;
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
+void StorageSet<Key, keyPrefixBitCount, Type, Storage>::
+mergeInto(BaseStorageSet<Key, keyPrefixBitCount>& dst,
+          const KeyRemap<Key, keyPrefixBitCount>& remap) {
+  auto& out = static_cast<StorageSet&>(dst);
+  auto first = out.storage_.size();
+
+  auto mapped = [&remap](Key key) {
+    return remap(key) != KeyRemap<Key, keyPrefixBitCount>::NullKey;
+  };
+
+  if (this->recyclingCount_ == 0 &&
+      std::all_of(this->dense_.begin(), this->dense_.end(), mapped)) {
+    // no holes: keys go one by one, the components in a single bulk move
+    std::for_each(this->dense_.begin(), this->dense_.end(), [&](Key key) {
+      out.appendKey(remap(key));
+    });
+
+    if constexpr (std::is_same_v<Storage, std::vector<Type>>) {
+      out.storage_.insert(out.storage_.end(),
+                          std::make_move_iterator(storage_.begin()),
+                          std::make_move_iterator(storage_.end()));
+    }
+    else {
+      for (size_t dPos = 0; dPos < storage_.size(); ++dPos)
+        out.moveSlot(out.storage_.size(), storage_, dPos);
+    }
+  }
+  else {
+    // keys without a remap entry are skipped as in migrateTo, clear() below
+    // drops their components
+    for (size_t dPos = 0; dPos < this->dense_.size(); ++dPos) {
+      if (this->validAt(dPos) && mapped(this->dense_[dPos])) {
+        out.appendKey(remap(this->dense_[dPos]));
+        out.moveSlot(out.storage_.size(), storage_, dPos);
+      }
+    }
+  }
+
+  for (auto dPos = first; dPos < out.storage_.size(); ++dPos) {
+    out.remapReferences(dPos, remap, *this);
+    out.indexInsert(out.dense_[dPos], dPos);
+  }
+
+  clear();
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
+void StorageSet<Key, keyPrefixBitCount, Type, Storage>::
+migrateTo(BaseStorageSet<Key, keyPrefixBitCount>& dst,
+          const Key* keys, size_t count,
+          const KeyRemap<Key, keyPrefixBitCount>& remap) {
+  auto& out = static_cast<StorageSet&>(dst);
+
+  for (size_t i = 0; i < count; ++i) {
+    auto key = keys[i];
+    auto newKey = remap(key);
+
+    if (!this->contains(key) ||
+        newKey == KeyRemap<Key, keyPrefixBitCount>::NullKey)
+      continue;
+
+    auto dPos = this->densePosFromKey(key);
+    indexErase(key);
+
+    auto pos = out.add(newKey);
+    if (pos != maxValue<decltype(pos)>()) {
+      out.moveSlot(pos, storage_, dPos);
+
+      out.remapReferences(pos, remap, *this);
+      out.indexInsert(newKey, pos);
+    }
+
+    dropMoved(key);
+  }
+}
+
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage>
+size_t StorageSet<Key, keyPrefixBitCount, Type, Storage>::
 add(Key key) {
   auto position = maxValue<size_t>();
 
@@ -211,9 +501,12 @@ add(Key key) {
     this->resizeContainersForKey(page, offset);
 
     if (this->recyclingCount_ == 0) {
-      assert(this->dense_.size() < densePageSizeMax &&
+      assert(this->dense_.size() < this->denseSizeMax() &&
              "Cannot add item, dense vector is full!");
 
+      if (this->dense_.size() == this->dense_.capacity())
+        PEBBLE_TRACE_ADD(StorageReallocations, 1);
+
       position = this->dense_.size();
       (*this->sparse_[page])[offset] =
           static_cast<typename BaseStorageSet<Key, keyPrefixBitCount>::BaseKey>(
@@ -230,20 +523,25 @@ add(Key key) {
       position = dPos;
       (*this->sparse_[page])[offset] = dPos;
       this->dense_[dPos] = key;
+
+      if constexpr (has_slot_claim<Storage>::value)
+        storage_.claim(dPos);
     }
   }
 
   return position;
 }
 
-template <typename Key, size_t keyPrefixBitCount, typename Type>
-StorageSet<Key, keyPrefixBitCount, Type>*
+template <typename Key, size_t keyPrefixBitCount, typename Type,
+          typename Storage = std::vector<Type>>
+StorageSet<Key, keyPrefixBitCount, Type, Storage>*
 storage_cast(BaseStorageSet<Key, keyPrefixBitCount>* basePtr) {
 
   if (basePtr && typeid(Type) == basePtr->storageType() &&
       typeid(Key) == basePtr->keyType()) {
 
-    return static_cast<StorageSet<Key, keyPrefixBitCount, Type>*>(basePtr);
+    return static_cast<StorageSet<Key, keyPrefixBitCount, Type, Storage>*>(
+        basePtr);
   }
   else
     return nullptr;
@@ -0,0 +1,127 @@
+//
+//  Trace.cpp
+//  PebbleEngine
+//
+
+#include "Trace.hpp"
+
+#ifdef PEBBLE_ECS_TRACE
+
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+
+
+namespace pebble {
+
+namespace {
+
+struct TraceRegistry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+};
+
+TraceRegistry& traceRegistry() {
+  static TraceRegistry registry;
+  return registry;
+}
+
+const char* traceCounterName(size_t counter) {
+  static const char* names[] = {
+    "entities visited",
+    "storage reallocations",
+    "sparse pages created"
+  };
+
+  return names[counter];
+}
+
+}
+
+uint64_t traceNow() {
+  static const auto epoch = std::chrono::steady_clock::now();
+
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - epoch).count();
+}
+
+TraceBuffer& threadTraceBuffer() {
+  // shared with the registry so events outlive the thread until exported
+  thread_local std::shared_ptr<TraceBuffer> buffer = []() {
+    auto& registry = traceRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    auto ptr = std::make_shared<TraceBuffer>(
+        static_cast<uint32_t>(registry.buffers.size()));
+    registry.buffers.push_back(ptr);
+
+    return ptr;
+  }();
+
+  return *buffer;
+}
+
+void traceAdd(TraceCounter counter, uint64_t amount) {
+  auto& buffer = threadTraceBuffer();
+  auto total = buffer.addTotal(counter, amount);
+
+  buffer.push({ traceCounterName(size_t(counter)), traceNow(), total, true });
+}
+
+void writeChromeTrace(std::ostream& out) {
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+  {
+    auto& registry = traceRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    buffers = registry.buffers;
+  }
+
+  auto flags = out.flags();
+  auto precision = out.precision();
+  bool first = true;
+
+  out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+
+  std::for_each(buffers.begin(), buffers.end(), [&](auto& buffer) {
+    buffer->drain([&](const TraceEvent& event) {
+      out << (first ? "\n" : ",\n")
+          << "{\"name\":\"" << event.name << "\""
+          << ",\"ph\":\"" << (event.counter ? "C" : "X") << "\""
+          << ",\"ts\":" << event.start / 1000.0
+          << ",\"pid\":1,\"tid\":" << buffer->threadId();
+
+      // the id gives every thread its own track for the same counter
+      if (event.counter)
+        out << ",\"id\":" << buffer->threadId()
+            << ",\"args\":{\"value\":" << event.value << "}}";
+      else
+        out << ",\"dur\":" << event.value / 1000.0 << "}";
+
+      first = false;
+    });
+  });
+
+  auto now = traceNow();
+
+  for (size_t counter = 0; counter < size_t(TraceCounter::Count); ++counter) {
+    uint64_t total = 0;
+    for (auto& buffer : buffers)
+      total += buffer->total(TraceCounter(counter));
+
+    out << (first ? "\n" : ",\n")
+        << "{\"name\":\"" << traceCounterName(counter) << "\""
+        << ",\"ph\":\"C\",\"ts\":" << now / 1000.0
+        << ",\"pid\":1,\"args\":{\"value\":" << total << "}}";
+
+    first = false;
+  }
+
+  out << "\n]}\n";
+
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}
+
+#endif
@@ -0,0 +1,132 @@
+//
+//  Trace.hpp
+//  PebbleEngine
+//
+
+#pragma once
+
+#include "../Core/PebbleCom.hpp"
+
+// Scoped timings and counters of the ECS hot paths, exported as Chrome trace
+// / Perfetto JSON. Compiled in only when PEBBLE_ECS_TRACE is defined, all
+// macros expand to nothing otherwise.
+#ifdef PEBBLE_ECS_TRACE
+
+#include <array>
+#include <ostream>
+
+
+namespace pebble {
+
+static constexpr size_t traceBufferSize = 1 << 16;
+
+enum class TraceCounter {
+  EntitiesVisited,
+  StorageReallocations,
+  SparsePagesCreated,
+  Count
+};
+
+struct TraceEvent {
+  const char* name;
+  uint64_t    start;  // ns since the first trace event
+  uint64_t    value;  // duration in ns for scopes, thread total for counters
+  bool        counter;
+};
+
+// single producer (the owning thread), single consumer (the exporter);
+// events are dropped while the ring is full
+class TraceBuffer {
+public:
+  explicit TraceBuffer(uint32_t threadId) : threadId_(threadId) {}
+
+  uint32_t threadId() const { return threadId_; }
+
+  // this thread's running total; only the owner writes, so no RMW is needed
+  // and the cache line stays with the owning thread
+  uint64_t addTotal(TraceCounter counter, uint64_t amount) {
+    auto& total = totals_[size_t(counter)];
+    auto value = total.load(std::memory_order_relaxed) + amount;
+    total.store(value, std::memory_order_relaxed);
+
+    return value;
+  }
+
+  uint64_t total(TraceCounter counter) const {
+    return totals_[size_t(counter)].load(std::memory_order_relaxed);
+  }
+
+  void push(const TraceEvent& event) {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == traceBufferSize)
+      return;
+
+    events_[modPow2(head, traceBufferSize)] = event;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  template <typename Functor>
+  void drain(Functor&& f) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto head = head_.load(std::memory_order_acquire);
+
+    for (; tail != head; ++tail)
+      f(events_[modPow2(tail, traceBufferSize)]);
+
+    tail_.store(tail, std::memory_order_release);
+  }
+
+private:
+  const uint32_t threadId_;
+  std::atomic<size_t> head_ = 0;
+  std::atomic<size_t> tail_ = 0;
+  std::array<std::atomic<uint64_t>, size_t(TraceCounter::Count)> totals_ = {};
+  std::array<TraceEvent, traceBufferSize> events_;
+};
+
+uint64_t traceNow();
+
+// the calling thread's buffer, registered for export on first use
+TraceBuffer& threadTraceBuffer();
+
+void traceAdd(TraceCounter counter, uint64_t amount);
+
+// drains every thread's buffer into a {"traceEvents": [...]} document;
+// counters appear once per thread plus a process-wide sum at export time
+void writeChromeTrace(std::ostream& out);
+
+class TraceScope {
+public:
+  explicit TraceScope(const char* name) : name_(name), start_(traceNow()) {}
+
+  ~TraceScope() {
+    threadTraceBuffer().push({ name_, start_, traceNow() - start_, false });
+  }
+
+private:
+  const char* name_;
+  uint64_t    start_;
+};
+
+}
+
+#define PEBBLE_TRACE_CONCAT_(a, b) a##b
+#define PEBBLE_TRACE_CONCAT(a, b) PEBBLE_TRACE_CONCAT_(a, b)
+
+#define PEBBLE_TRACE_SCOPE(name) \
+  ::pebble::TraceScope PEBBLE_TRACE_CONCAT(traceScope_, __LINE__)(name)
+
+#define PEBBLE_TRACE_ADD(counter, amount) \
+  ::pebble::traceAdd(::pebble::TraceCounter::counter, (amount))
+
+#define PEBBLE_TRACE_VALUE(name, value) \
+  ::pebble::threadTraceBuffer().push({ (name), ::pebble::traceNow(), \
+                                       uint64_t(value), true })
+
+#else
+
+#define PEBBLE_TRACE_SCOPE(name)          ((void)0)
+#define PEBBLE_TRACE_ADD(counter, amount) ((void)0)
+#define PEBBLE_TRACE_VALUE(name, value)   ((void)0)
+
+#endif
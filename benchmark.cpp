@@ -0,0 +1,84 @@
+#include "Registry.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+// 2 KB, so the components (about 300 MB) do not fit in the last-level cache
+// and every lookup of a random target misses to DRAM
+struct position {
+  float x, y, z, w;
+  float padding[508];
+};
+
+template <typename Functor>
+double bestOf(int runs, Functor&& f) {
+  double best = pebble::maxValue<double>();
+
+  for (int run = 0; run < runs; ++run) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+
+  return best;
+}
+
+int main(int, const char*[]) {
+  using namespace pebble;
+
+  constexpr size_t entityCount = 150000;
+  constexpr size_t lookupCount = 1 << 20;
+  constexpr size_t batchSize   = 256;
+
+  Registry registry;
+  std::vector<Entity> entities;
+
+  for (size_t i = 0; i < entityCount; ++i) {
+    entities.push_back(registry.createEntity());
+    registry.addComponent<position>(entities.back(),
+                                    { float(i), 0.f, 0.f, 0.f, {} });
+  }
+
+  // random references, like targets or collision pairs
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<size_t> pick(0, entityCount - 1);
+  std::vector<Entity> targets(lookupCount);
+  for (auto& target : targets)
+    target = entities[pick(rng)];
+
+  std::vector<position*> out(lookupCount);
+  float sink = 0.f;
+
+  // each case reads the component it found, as a consumer would
+  auto scalar = bestOf(5, [&]() {
+    for (size_t i = 0; i < lookupCount; ++i)
+      sink += registry.getComponent<position>(targets[i])->x;
+  });
+
+  // same lookups without the per-call storage lookup of getComponent
+  auto direct = bestOf(5, [&]() {
+    auto storage = registry.getComponentStorage<position>();
+    for (size_t i = 0; i < lookupCount; ++i)
+      sink += storage->get(targets[i])->x;
+  });
+
+  auto batched = bestOf(5, [&]() {
+    for (size_t first = 0; first < lookupCount; first += batchSize) {
+      registry.getComponents<position>(targets.data() + first, batchSize,
+                                       out.data() + first);
+      for (size_t i = first; i < first + batchSize; ++i)
+        sink += out[i]->x;
+    }
+  });
+
+  std::printf("getComponent       (scalar):  %10.1f us\n", scalar);
+  std::printf("StorageSet::get    (scalar):  %10.1f us  (%.2fx)\n",
+              direct, scalar / direct);
+  std::printf("getComponents      (batched): %10.1f us  (%.2fx)\n",
+              batched, scalar / batched);
+
+  return sink == 0.f;
+}
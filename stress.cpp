@@ -0,0 +1,66 @@
+#include "Registry.hpp"
+
+#include <cstdio>
+#include <thread>
+
+// Concurrent entity allocation: workers create from their own blocks and
+// from the recycling stack, release what is left, and every handle handed
+// out must be unique. Run under -fsanitize=thread.
+int main(int, const char*[]) {
+  using namespace pebble;
+
+  constexpr size_t threadCount = 8;
+  constexpr size_t perThread = 20000;
+  constexpr size_t rounds = 4;
+
+  Registry registry;
+  std::vector<Entity> seeded;
+
+  // half of them deleted so the recycling stack is contended too
+  for (size_t i = 0; i < 4096; ++i)
+    seeded.push_back(registry.createEntity());
+  for (size_t i = 0; i < seeded.size(); i += 2)
+    registry.deleteEntity(seeded[i]);
+
+  size_t failures = 0;
+
+  for (size_t round = 0; round < rounds; ++round) {
+    registry.reserveEntities(threadCount * perThread * (round + 1) + 4096);
+
+    std::vector<std::vector<Entity>> created(threadCount);
+    std::vector<std::thread> workers;
+
+    for (size_t t = 0; t < threadCount; ++t) {
+      workers.emplace_back([&registry, &created, t]() {
+        EntityBlock block;
+        for (size_t i = 0; i < perThread; ++i)
+          created[t].push_back(registry.createEntity(block, i % 3 == 0));
+        registry.releaseEntityBlock(block);
+      });
+    }
+
+    for (auto& worker : workers)
+      worker.join();
+
+    std::vector<Entity> all;
+    for (auto& list : created)
+      all.insert(all.end(), list.begin(), list.end());
+
+    auto total = all.size();
+    auto nulls = size_t(std::count(all.begin(), all.end(), NullEntity));
+
+    std::sort(all.begin(), all.end());
+    all.erase(std::unique(all.begin(), all.end()), all.end());
+    auto duplicates = total - all.size();
+
+    std::printf("round %zu: %zu handles, %zu null, %zu duplicated\n",
+                round, total, nulls, duplicates);
+    failures += nulls + duplicates;
+
+    // return a share to the recycling stack for the next round
+    for (size_t i = 0; i < all.size(); i += 4)
+      registry.deleteEntity(all[i]);
+  }
+
+  return failures != 0;
+}